@@ -21,6 +21,14 @@
 #include <QtOpenGL>
 #include <QtSvg>
 
+#include "texturebuffer.h"
+#include "tilebenchmark.h"
+#include "tilecache.h"
+#include "tileprefetcher.h"
+#include "tilepyramid.h"
+#include "tilerenderer.h"
+#include "tilescheduler.h"
+
 // gl.h on Windows is OpenGL 1.1. GL_CLAMP_TO_EDGE is missing.
 #ifndef GL_CLAMP_TO_EDGE
 #define GL_CLAMP_TO_EDGE 0x812F
@@ -29,8 +37,6 @@
 // Uncomment to follow the slower update and refresh
 // #define TILE_DEBUG
 
-const int TileDim = 128;
-
 const qreal MinZoom = 0.2;
 const qreal MaxZoom = 20;
 
@@ -44,6 +50,21 @@ const int RefreshDelay = 200;
 const int ExtraTiles = 2;
 #endif
 
+// Tiles queued for every rendering thread. Enough to keep the threads busy
+// between two updates, few enough to follow panning closely.
+const int TilesPerThread = 2;
+
+// Texture memory for the tiles of every zoom level, in megabytes.
+const int TextureBudget = 64;
+
+// Disk space for the tiles kept across launches, in megabytes.
+const int DiskCacheBudget = 256;
+
+// Benchmark frames are paced like a display would, a zoom level still not
+// complete after the time out counts as never reached.
+const int BenchmarkFrameInterval = 16;
+const int BenchmarkViewportTimeout = 10000;
+
 // The default texture holds a typical checkerboard pattern, used
 // as "placeholder" for outdated tiles.
 static QImage createCheckerboardPattern(int dim)
@@ -60,179 +81,44 @@ static QImage createCheckerboardPattern(int dim)
     return pattern;
 }
 
-class TextureBuffer
-{
-public:
-    qreal zoomFactor;
-
-    TextureBuffer();
-    TextureBuffer& operator=(const TextureBuffer&);
-
-    bool isEmpty() const;
-    void clear();
-
-    GLuint at(int x, int y) const;
-    void replace(int x, int y, GLuint texture);
-    void remove(int x, int y);
-
-    int width() const;
-    int height() const;
-    void resize(int w, int h);
-
-    void draw(int x, int y, GLuint substitute = 0) const;
-    void setViewModelMatrix(const QPointF &viewOffset, qreal viewZoomFactor) const;
-    QRect visibleRange(const QPointF &viewOffset, qreal viewZoomFactor,
-                     const QSize &viewSize) const;
-
-private:
-    QVector<GLuint> textures;
-    QSize bufferSize;
-};
-
-TextureBuffer::TextureBuffer()
-    : zoomFactor(0.1)
-{
-}
-
-TextureBuffer& TextureBuffer::operator =(const TextureBuffer &buffer)
-{
-    textures = buffer.textures;
-    zoomFactor = buffer.zoomFactor;
-    bufferSize = buffer.bufferSize;
-    return *this;
-}
-
-bool TextureBuffer::isEmpty() const
-{
-    return textures.isEmpty();
-}
-
-void TextureBuffer::clear()
-{
-    if (!textures.isEmpty()) {
-        glDeleteTextures(textures.count(), textures.constData());
-        textures.clear();
-    }
-    bufferSize = QSize(0, 0);
-}
-
-GLuint TextureBuffer::at(int x, int y) const
-{
-    int index = y * bufferSize.width() + x;
-    if (index < 0 || index >= textures.count())
-        return 0;
-    return textures.at(index);
-}
-
-// Note: does not free the existing texture!
-void TextureBuffer::replace(int x, int y, GLuint texture)
-{
-    int index = y * bufferSize.width() + x;
-    if (index < 0 || index >= textures.count())
-        return;
-    textures[index] = texture;
-}
-
-void TextureBuffer::remove(int x, int y)
-{
-    int index = y * bufferSize.width() + x;
-    if (index < 0 || index >= textures.count())
-        return;
-    if (textures.at(index) != 0) {
-        glDeleteTextures(1, textures.constData() + index);
-        textures[index] = 0;
-    }
-}
-
-int TextureBuffer::width() const
-{
-    return bufferSize.width();
-}
-
-int TextureBuffer::height() const
-{
-    return bufferSize.height();
-}
-
-void TextureBuffer::resize(int w, int h)
-{
-    bufferSize = QSize(w, h);
-    textures.resize(w * h);
-    textures.fill(0);
-}
-
-// Each tile is drawn as textured quad.
-void TextureBuffer::draw(int x, int y, GLuint substitute) const
-{
-    int index = y * bufferSize.width() + x;
-    if (index < 0 || index >= textures.count())
-        return;
-
-    GLuint texture = textures.at(index);
-    if (texture == 0)
-        texture = substitute;
-    if (texture == 0)
-        return;
-
-    float tx = x * TileDim;
-    float ty = y * TileDim;
-
-    glBindTexture(GL_TEXTURE_2D, texture);
-    glBegin(GL_QUADS);
-    glTexCoord2f(0.0f, 1.0f);
-    glVertex2f(tx, ty);
-    glTexCoord2f(1.0f, 1.0f);
-    glVertex2f(tx + TileDim, ty);
-    glTexCoord2f(1.0f, 0.0f);
-    glVertex2f(tx + TileDim, ty + TileDim);
-    glTexCoord2f(0.0f, 0.0f);
-    glVertex2f(tx, ty + TileDim);
-    glEnd();
-}
-
-void TextureBuffer::setViewModelMatrix(const QPointF &viewOffset, qreal viewZoomFactor) const
-{
-    glMatrixMode(GL_MODELVIEW);
-    glLoadIdentity();
-    glTranslatef(viewOffset.x(), viewOffset.y(), 0);
-    glScalef(viewZoomFactor / zoomFactor, viewZoomFactor / zoomFactor, 1);
-}
-
-QRect TextureBuffer::visibleRange(const QPointF &viewOffset,
-    qreal viewZoomFactor, const QSize &viewSize) const
-{
-    qreal dim = TileDim * viewZoomFactor / zoomFactor;
-
-    int tx1 = -viewOffset.x() / dim;
-    int tx2 = (viewSize.width() -viewOffset.x()) / dim;
-    int ty1 = -viewOffset.y() / dim;
-    int ty2 = (viewSize.height() - viewOffset.y()) / dim;
-
-    tx1 = qMax(0, tx1);
-    tx2 = qMin(bufferSize.width() - 1, tx2);
-    ty1 = qMax(0, ty1);
-    ty2 = qMin(bufferSize.height() - 1, ty2);
-
-    return QRect(QPoint(tx1, ty1), QPoint(tx2, ty2));
-}
-
 
 class GLTiger: public QGLWidget
 {
 public:
     GLTiger(QWidget *parent = 0);
+    ~GLTiger();
+
+    void setTextureBudget(int megabytes);
+    // Zero disables the disk cache. Only effective before the widget is shown.
+    void setDiskCacheBudget(int megabytes);
+
+    // The document changed within the area, in document units. The tiles
+    // covering it are rendered again at every zoom level, the stale ones
+    // staying on screen meanwhile. Invalidations are applied all at once
+    // with the next update.
+    void invalidate(const QRectF &area);
+
+    // Replays the trajectory against the view, rendering frames as it goes.
+    BenchmarkResult runBenchmark(const QList<BenchmarkStep> &steps);
 
 private:
     void scheduleUpdate();
     void scheduleRefresh();
     void updateBackingStore();
     void refreshBackingStore();
+    void uploadRenderedTiles();
+    void applyInvalidations();
+    QRect updateRange() const;
+    bool isViewportComplete() const;
+    void panBy(const QPointF &delta);
+    void runEventLoop(int msecs);
 
 protected:
     void initializeGL();
     void paintGL();
     void resizeGL(int width, int height);
     void timerEvent(QTimerEvent *event);
+    void customEvent(QEvent *event);
     void mouseDoubleClickEvent(QMouseEvent *event);
     void mousePressEvent(QMouseEvent *event);
     void mouseMoveEvent(QMouseEvent *event);
@@ -246,11 +132,19 @@ private:
 
     QPointF m_viewOffset;
     qreal m_viewZoomFactor;
-    QSvgRenderer m_svg;
+    TileRenderer *m_renderer;
+    TileCache *m_cache;
+    int m_diskCacheBudget;
+    TileScheduler m_scheduler;
+    TilePrefetcher m_prefetcher;
 
     GLuint m_defaultTexture;
-    TextureBuffer m_mainBuffer;
-    TextureBuffer m_secondaryBuffer;
+    TilePyramid m_pyramid;
+    TextureBuffer *m_mainBuffer;
+    QList<QRectF> m_invalidAreas;
+
+    int m_tilesRendered;
+    QVector<qint64> *m_frameTimes;
 };
 
 GLTiger::GLTiger(QWidget *parent)
@@ -260,11 +154,56 @@ GLTiger::GLTiger(QWidget *parent)
     , m_refreshTimer(-1)
     , m_viewOffset(0, 0)
     , m_viewZoomFactor(1)
+    , m_renderer(0)
+    , m_cache(0)
+    , m_diskCacheBudget(DiskCacheBudget)
+    , m_prefetcher(ExtraTiles)
     , m_defaultTexture(0)
+    , m_pyramid(qint64(TextureBudget) * 1024 * 1024)
+    , m_mainBuffer(0)
+    , m_tilesRendered(0)
+    , m_frameTimes(0)
 {
     setAttribute(Qt::WA_NoSystemBackground);
 }
 
+// The texture atlas and its pixel buffers go away with the members, that
+// needs the context.
+GLTiger::~GLTiger()
+{
+    delete m_renderer;
+    delete m_cache;
+    makeCurrent();
+}
+
+void GLTiger::setTextureBudget(int megabytes)
+{
+    m_pyramid.setBudget(qint64(megabytes) * 1024 * 1024);
+}
+
+void GLTiger::setDiskCacheBudget(int megabytes)
+{
+    m_diskCacheBudget = megabytes;
+}
+
+// An area within a pending one adds nothing, an area covering pending
+// ones replaces them.
+void GLTiger::invalidate(const QRectF &area)
+{
+    for (int i = m_invalidAreas.count() - 1; i >= 0; --i) {
+        if (m_invalidAreas.at(i).contains(area))
+            return;
+        if (area.contains(m_invalidAreas.at(i)))
+            m_invalidAreas.removeAt(i);
+    }
+
+    // Restarting the timer on every call would postpone the update for as
+    // long as the document keeps changing.
+    if (m_invalidAreas.isEmpty())
+        scheduleUpdate();
+    m_invalidAreas += area;
+}
+
 void GLTiger::scheduleUpdate()
 {
     killTimer(m_updateTimer);
@@ -279,21 +218,27 @@ void GLTiger::scheduleRefresh()
 
 void GLTiger::refreshBackingStore()
 {
-    if (m_mainBuffer.zoomFactor == m_viewZoomFactor)
+    if (m_mainBuffer && m_mainBuffer->zoomFactor == m_viewZoomFactor)
         return;
 
-    // All secondary textures serve as the "background overlay".
-    m_secondaryBuffer.clear();
-    m_secondaryBuffer = m_mainBuffer;
+    // Tiles of the previous zoom level still in the queue are useless now.
+    m_renderer->clear();
+    m_prefetcher.reset();
 
-    // Replace the primary textures with an invalid, dirty texture.
-    qreal width = m_svg.defaultSize().width() * m_viewZoomFactor;
-    qreal height = m_svg.defaultSize().height() * m_viewZoomFactor;
+    // Switch to the level of the new zoom factor. The textures of the
+    // previous one stay as the "background overlay". When coming back to a
+    // recent level, whatever is left of its tiles needs no update.
+    qreal width = m_renderer->documentSize().width() * m_viewZoomFactor;
+    qreal height = m_renderer->documentSize().height() * m_viewZoomFactor;
     int horizontal = (width + TileDim - 1) / TileDim;
     int vertical = (height + TileDim - 1) / TileDim;
-    m_mainBuffer.resize(horizontal, vertical);
+    m_mainBuffer = m_pyramid.setCurrentLevel(m_viewZoomFactor, horizontal, vertical);
+    m_scheduler.reset(horizontal, vertical);
+    for (int y = 0; y < vertical; ++y)
+        for (int x = 0; x < horizontal; ++x)
+            if (m_mainBuffer->at(x, y) != 0 && !m_pyramid.isOutdated(x, y))
+                m_scheduler.markDone(x, y);
 
-    m_mainBuffer.zoomFactor = m_viewZoomFactor;
     scheduleUpdate();
 
     killTimer(m_refreshTimer);
@@ -302,65 +247,136 @@ void GLTiger::refreshBackingStore()
 
 void GLTiger::updateBackingStore()
 {
+    // Before initializeGL(), e.g. after an early invalidate(): the areas
+    // are kept for the first update.
+    if (!m_mainBuffer)
+        return;
+
+    if (!m_invalidAreas.isEmpty())
+        applyInvalidations();
+
     // During zooming in and out, do not bother.
-    if (m_mainBuffer.zoomFactor != m_viewZoomFactor)
+    if (m_mainBuffer->zoomFactor != m_viewZoomFactor)
         return;
 
-    // Extend the update range with extra tiles in every direction, this is
-    // to anticipate panning and scrolling.
-    QRect updateRange = m_mainBuffer.visibleRange(m_viewOffset, m_viewZoomFactor, size());
-    updateRange.adjust(-ExtraTiles, -ExtraTiles, ExtraTiles, ExtraTiles);
-
-    // Collect all visible tiles which need update.
-    QList<QPoint> dirtyTiles;
-    for (int x = 0; x < m_mainBuffer.width(); ++x) {
-        for (int y = 0; y < m_mainBuffer.height(); ++y) {
-            if (m_mainBuffer.at(x, y) == 0 && updateRange.contains(x, y))
-                dirtyTiles += QPoint(x, y);
-        }
+    // The center of the view, in tiles.
+    QRect range = updateRange();
+    qreal dim = TileDim * m_viewZoomFactor / m_mainBuffer->zoomFactor;
+    QPointF center((width() / 2 - m_viewOffset.x()) / dim, (height() / 2 - m_viewOffset.y()) / dim);
+    m_scheduler.setView(range, center);
+
+    // Queued tiles which fell out of the predicted range are not worth
+    // rendering anymore.
+    QList<TileRequest> cancelled = m_renderer->cancelOutside(range);
+    foreach (const TileRequest &tile, cancelled)
+        m_scheduler.markDirty(tile.x, tile.y);
+    m_prefetcher.tilesCancelled(cancelled.count());
+
+    // Keep every rendering thread busy, but not more: the queue is refilled
+    // as tiles are done, always with the ones closest to the center.
+    int capacity = TilesPerThread * m_renderer->threadCount() - m_renderer->pendingCount();
+    QPoint next;
+    uint generation = m_cache ? m_cache->generation() : 0;
+    for (int i = 0; i < capacity && m_scheduler.takeNext(&next); ++i) {
+        TileRequest tile;
+        tile.zoomFactor = m_mainBuffer->zoomFactor;
+        tile.x = next.x();
+        tile.y = next.y();
+        tile.generation = generation;
+        m_renderer->request(tile);
     }
 
-    if (!dirtyTiles.isEmpty()) {
-
-        // Find the closest tile to the center (using Manhattan distance)
-        int updateX = dirtyTiles.at(0).x();
-        int updateY = dirtyTiles.at(0).y();
-        qreal closestDistance = 1e6;
-        for (int i = 0; i < dirtyTiles.count(); ++i) {
-            int tx = dirtyTiles.at(i).x();
-            int ty = dirtyTiles.at(i).y();
-            qreal dim = TileDim * m_viewZoomFactor / m_mainBuffer.zoomFactor;
-            qreal cx = m_viewOffset.x() + dim * (0.5 + tx);
-            qreal cy = m_viewOffset.y() + dim * (0.5 + ty);
-            qreal dist = qAbs(cx - width() / 2) + qAbs(cy - height() / 2);
-            if (dist < closestDistance) {
-                updateX = tx;
-                updateY = ty;
-                closestDistance = dist;
-            }
-        }
+    killTimer(m_updateTimer);
+    m_updateTimer = 0;
+}
 
-        // Update the closest tile and bind as texture.
-        QImage content(TileDim, TileDim, QImage::Format_ARGB32);
-        content.fill(qRgb(255, 255, 255));
-        QPainter p(&content);
-        p.setRenderHint(QPainter::Antialiasing, true);
-        p.translate(-updateX * TileDim, -updateY * TileDim);
-        p.scale(m_mainBuffer.zoomFactor, m_mainBuffer.zoomFactor);
-        m_svg.render(&p, QRect(QPoint(0, 0), m_svg.defaultSize()));
-        p.end();
+// Runs on the GUI thread: the tiles are only bound as textures here, the
+// rendering happened in the worker threads.
+void GLTiger::uploadRenderedTiles()
+{
+    QList<RenderedTile> tiles = m_renderer->takeRenderedTiles();
+    if (tiles.isEmpty())
+        return;
+    m_tilesRendered += tiles.count();
+
+    QRect visibleRange = m_mainBuffer->visibleRange(m_viewOffset, m_viewZoomFactor, size());
+
+    makeCurrent();
+    foreach (RenderedTile tile, tiles) {
+        // Rendered before the content changed: once more.
+        if (tile.zoomFactor == m_mainBuffer->zoomFactor && m_scheduler.isOutdated(tile.x, tile.y)) {
+            m_scheduler.markDirty(tile.x, tile.y);
+            if (m_cache)
+                m_cache->remove(tile.zoomFactor, tile.x, tile.y);
+            continue;
+        }
+        // Leftovers from a previous zoom level.
+        if (tile.zoomFactor != m_mainBuffer->zoomFactor || !m_scheduler.isPending(tile.x, tile.y)) {
+            m_prefetcher.tileDiscarded();
+            continue;
+        }
+        m_scheduler.markDone(tile.x, tile.y);
+        m_prefetcher.tileRendered(tile.y * m_mainBuffer->width() + tile.x,
+                                  visibleRange.contains(tile.x, tile.y));
 #ifdef TILE_DEBUG
-        p.begin(&content);
+        QPainter p(&tile.image);
         p.drawRect(3, 3, TileDim - 6, TileDim - 6);
-        p.drawText(4, 16, QString("%1 %2").arg(updateX).arg(updateY));
+        p.drawText(4, 16, QString("%1 %2").arg(tile.x).arg(tile.y));
         p.end();
 #endif
-        m_mainBuffer.replace(updateX, updateY, bindTexture(content));
-        update();
+        m_pyramid.insert(tile.x, tile.y, tile.image);
     }
 
-    killTimer(m_updateTimer);
-    m_updateTimer = 0;
+    // Make room within the texture budget.
+    foreach (const QPoint &tile, m_pyramid.trim()) {
+        m_scheduler.markDirty(tile.x(), tile.y());
+        m_prefetcher.tileEvicted(tile.y() * m_mainBuffer->width() + tile.x());
+    }
+
+    // Refill the queue and show the new tiles.
+    scheduleUpdate();
+    update();
+}
+
+// Resident tiles keep their texture until the new one arrives, tiles being
+// rendered are discarded once done. Either way, they get back in the queue.
+void GLTiger::applyInvalidations()
+{
+    if (!m_mainBuffer)
+        return;
+    foreach (const QRectF &area, m_invalidAreas) {
+        m_pyramid.invalidate(area);
+        if (m_cache)
+            m_cache->invalidate(area);
+        QRect range = m_mainBuffer->tileRange(area);
+        for (int y = range.top(); y <= range.bottom(); ++y)
+            for (int x = range.left(); x <= range.right(); ++x)
+                m_scheduler.invalidate(x, y);
+    }
+    m_invalidAreas.clear();
+}
+
+// Extend the visible range with extra tiles, this is to anticipate panning
+// and scrolling. While panning, most of them lie ahead of the motion.
+QRect GLTiger::updateRange() const
+{
+    QRect visibleRange = m_mainBuffer->visibleRange(m_viewOffset, m_viewZoomFactor, size());
+    qreal dim = TileDim * m_viewZoomFactor / m_mainBuffer->zoomFactor;
+    QRect range = m_prefetcher.predictedRange(visibleRange, dim);
+    return range & QRect(0, 0, m_mainBuffer->width(), m_mainBuffer->height());
+}
+
+// The current zoom level is in place and every visible tile of it is there.
+bool GLTiger::isViewportComplete() const
+{
+    if (!m_mainBuffer || m_mainBuffer->zoomFactor != m_viewZoomFactor)
+        return false;
+    QRect visibleRange = m_mainBuffer->visibleRange(m_viewOffset, m_viewZoomFactor, size());
+    for (int y = visibleRange.top(); y <= visibleRange.bottom(); ++y)
+        for (int x = visibleRange.left(); x <= visibleRange.right(); ++x)
+            if (m_mainBuffer->at(x, y) == 0)
+                return false;
+    return true;
 }
 
 void GLTiger::initializeGL()
@@ -368,13 +384,35 @@ void GLTiger::initializeGL()
     glDisable(GL_DEPTH_TEST);
     glEnable(GL_TEXTURE_2D);
     m_defaultTexture = bindTexture(createCheckerboardPattern(TileDim));
-    m_svg.load(QString(":/tiger.svg"));
+
+    QFile file(":/tiger.svg");
+    file.open(QFile::ReadOnly);
+    QByteArray document = file.readAll();
+    if (m_diskCacheBudget > 0) {
+        m_cache = new TileCache(TileCache::defaultFileName(), document, TileDim,
+                                qint64(m_diskCacheBudget) * 1024 * 1024);
+    }
+    m_renderer = new TileRenderer(document, TileDim, this, m_cache);
     refreshBackingStore();
 }
 
 void GLTiger::paintGL()
 {
+    QElapsedTimer frameTimer;
+    frameTimer.start();
+
+#ifdef TILE_DEBUG
+    setWindowTitle(QString("GLTiger - Zoom %1% - Queue %2 (max %3) - Pending %4 - Rebuilds %5"
+                           " - Prefetch hits %6% - Wasted %7 - Cancelled %8")
+                   .arg(qRound(m_viewZoomFactor * 100))
+                   .arg(m_scheduler.queueDepth()).arg(m_scheduler.maxQueueDepth())
+                   .arg(m_scheduler.pendingCount()).arg(m_scheduler.rebuildCount())
+                   .arg(qRound(m_prefetcher.hitRate() * 100))
+                   .arg(m_prefetcher.wastedCount()).arg(m_prefetcher.cancelledCount())
+                   + QString(" - Textures %1 MB").arg(m_pyramid.memoryUsage() >> 20));
+#else
     setWindowTitle(QString("GLTiger - Zoom %1%").arg(qRound(m_viewZoomFactor * 100)));
+#endif
 
     glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT);
@@ -387,62 +425,45 @@ void GLTiger::paintGL()
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
-    // This is background, i.e. all the outdated tiles while
-    // new primary ones are being prepared (e.g. after zooming).
-    if (!m_secondaryBuffer.isEmpty()) {
-        QRect backgroundRange = m_secondaryBuffer.visibleRange(m_viewOffset, m_viewZoomFactor, size());
-        m_secondaryBuffer.setViewModelMatrix(m_viewOffset, m_viewZoomFactor);
-
-        for (int x = 0; x < m_secondaryBuffer.width(); ++x) {
-            for (int y = 0; y < m_secondaryBuffer.height(); ++y) {
-                if (backgroundRange.contains(x, y))
-                    m_secondaryBuffer.draw(x, y, m_defaultTexture);
-                else
-                    m_secondaryBuffer.remove(x, y);
-            }
-        }
+    m_pyramid.nextFrame();
+
+    QRect visibleRange = m_mainBuffer->visibleRange(m_viewOffset, m_viewZoomFactor, size());
+    QRect range = updateRange();
+
+    // Missing tiles get the checkerboard pattern first, other zoom levels
+    // may still have better to draw over it.
+    m_mainBuffer->setViewModelMatrix(m_viewOffset, m_viewZoomFactor);
+    bool needsUpdate = m_mainBuffer->drawMissing(range, m_defaultTexture) > 0;
+
+    // The outdated tiles of other levels serve as the background while
+    // the current level is being prepared (e.g. after zooming). The level
+    // closest to the view comes last, i.e. on top.
+    foreach (const TextureBuffer *buffer, m_pyramid.levels(m_viewZoomFactor)) {
+        bool current = (buffer == m_mainBuffer);
+        QRect levelRange = current ? range : buffer->visibleRange(m_viewOffset, m_viewZoomFactor, size());
+        buffer->setViewModelMatrix(m_viewOffset, m_viewZoomFactor);
+        buffer->draw(levelRange);
+        m_pyramid.touch(buffer, levelRange);
     }
 
-    // Extend the update range with extra tiles in every direction, this is
-    // to anticipate panning and scrolling.
-    QRect updateRange = m_mainBuffer.visibleRange(m_viewOffset, m_viewZoomFactor, size());
-    updateRange.adjust(-ExtraTiles, -ExtraTiles, ExtraTiles, ExtraTiles);
-
-    // When zooming in/out, we have secondary textures as
-    // the background. Thus, do not overdraw the background
-    // with the checkerboard pattern (default texture).
-    GLuint substitute = m_secondaryBuffer.isEmpty() ? m_defaultTexture : 0;
-
-    m_mainBuffer.setViewModelMatrix(m_viewOffset, m_viewZoomFactor);
-    bool needsUpdate = false;
-    for (int x = 0; x < m_mainBuffer.width(); ++x) {
-        for (int y = 0; y < m_mainBuffer.height(); ++y) {
-            GLuint texture = m_mainBuffer.at(x, y);
-            if (updateRange.contains(x, y)) {
-                m_mainBuffer.draw(x, y, substitute);
-                if (texture == 0)
-                    needsUpdate = true;
-            }
-
-            // Save GPU memory and throw out unneeded texture
-            if (texture != 0 && !updateRange.contains(x, y))
-                m_mainBuffer.remove(x, y);
-        }
-    }
+    for (int y = visibleRange.top(); y <= visibleRange.bottom(); ++y)
+        for (int x = visibleRange.left(); x <= visibleRange.right(); ++x)
+            if (m_mainBuffer->at(x, y) != 0)
+                m_prefetcher.tileShown(y * m_mainBuffer->width() + x);
 
-    if (needsUpdate) {
+    if (needsUpdate)
         scheduleUpdate();
-    } else {
-        // Every tile is up-to-date, thus discard the background.
-        if (!m_secondaryBuffer.isEmpty()) {
-            m_secondaryBuffer.clear();
-            update();
-        }
-    }
 
     // Zooming means we need a fresh set of resolution-correct tiles.
-    if (m_viewZoomFactor != m_mainBuffer.zoomFactor)
+    if (m_viewZoomFactor != m_mainBuffer->zoomFactor)
         scheduleRefresh();
+
+    // Without waiting for the GPU, only the time to issue the commands
+    // would be measured.
+    if (m_frameTimes) {
+        glFinish();
+        *m_frameTimes += frameTimer.nsecsElapsed();
+    }
 }
 
 void GLTiger::resizeGL(int width, int height)
@@ -464,6 +485,12 @@ void GLTiger::timerEvent(QTimerEvent *event)
         refreshBackingStore();
 }
 
+void GLTiger::customEvent(QEvent *event)
+{
+    if (event->type() == TileRenderer::TileRenderedEvent)
+        uploadRenderedTiles();
+}
+
 void GLTiger::mouseDoubleClickEvent(QMouseEvent *event)
 {
     qreal scale = (event->modifiers() & Qt::ControlModifier) ? 0.5 : 2.0;
@@ -472,19 +499,27 @@ void GLTiger::mouseDoubleClickEvent(QMouseEvent *event)
 
 void GLTiger::mousePressEvent(QMouseEvent *event)
 {
-    if (event->buttons() & Qt::LeftButton)
+    if (event->buttons() & Qt::LeftButton) {
         m_mousePressPosition = event->pos();
+        m_prefetcher.startPan();
+    }
 }
 
 void GLTiger::mouseMoveEvent(QMouseEvent *event)
 {
     if (event->buttons() & Qt::LeftButton) {
-        m_viewOffset += (event->pos() - m_mousePressPosition);
+        panBy(event->pos() - m_mousePressPosition);
         m_mousePressPosition = event->pos();
-        update();
     }
 }
 
+void GLTiger::panBy(const QPointF &delta)
+{
+    m_prefetcher.addPanSample(delta);
+    m_viewOffset += delta;
+    update();
+}
+
 void GLTiger::mouseZoom(qreal zoomFactor, QPoint pos)
 {
     qreal oldZoom = m_viewZoomFactor;
@@ -505,10 +540,130 @@ void GLTiger::wheelEvent(QWheelEvent *event)
     mouseZoom(m_viewZoomFactor + dz, event->pos());
 }
 
+// Rendered tiles, timers and paint events are all delivered meanwhile.
+void GLTiger::runEventLoop(int msecs)
+{
+    QEventLoop loop;
+    QTimer::singleShot(msecs, &loop, SLOT(quit()));
+    loop.exec();
+}
+
+// A frame is requested every interval, as if the trajectory came from the
+// mouse. The time to full viewport runs from a zoom (or from the start)
+// until every visible tile of the new level is in place.
+BenchmarkResult GLTiger::runBenchmark(const QList<BenchmarkStep> &steps)
+{
+    BenchmarkResult result;
+    QElapsedTimer clock;
+    clock.start();
+
+    while (!m_renderer)
+        runEventLoop(BenchmarkFrameInterval);
+
+    m_frameTimes = &result.frameTimes;
+    m_tilesRendered = 0;
+    qint64 zoomStart = 0;
+
+    foreach (const BenchmarkStep &step, steps) {
+        qint64 start = clock.elapsed();
+        QPointF panned(0, 0);
+
+        if (step.type == BenchmarkStep::Pan) {
+            m_prefetcher.startPan();
+        } else if (step.type == BenchmarkStep::Zoom) {
+            if (zoomStart >= 0)
+                ++result.incompleteViewports;
+            mouseZoom(m_viewZoomFactor * step.factor, step.center);
+            zoomStart = clock.elapsed();
+        }
+
+        do {
+            if (step.type == BenchmarkStep::Pan) {
+                qreal progress = 1;
+                if (step.duration > 0)
+                    progress = qMin<qreal>(1, qreal(clock.elapsed() - start) / step.duration);
+                panBy(step.delta * progress - panned);
+                panned = step.delta * progress;
+            }
+            update();
+            runEventLoop(BenchmarkFrameInterval);
+            if (zoomStart >= 0 && isViewportComplete()) {
+                result.viewportTimes += clock.elapsed() - zoomStart;
+                zoomStart = -1;
+            }
+        } while (clock.elapsed() - start < step.duration);
+    }
+
+    // Let the last zoom complete.
+    qint64 end = clock.elapsed();
+    while (zoomStart >= 0) {
+        if (clock.elapsed() - end > BenchmarkViewportTimeout) {
+            ++result.incompleteViewports;
+            break;
+        }
+        update();
+        runEventLoop(BenchmarkFrameInterval);
+        if (isViewportComplete()) {
+            result.viewportTimes += clock.elapsed() - zoomStart;
+            zoomStart = -1;
+        }
+    }
+
+    m_frameTimes = 0;
+    result.tilesRendered = m_tilesRendered;
+    result.tilesWasted = m_prefetcher.wastedCount();
+    result.texturePeak = m_pyramid.peakMemoryUsage();
+    return result;
+}
+
 int main(int argc, char *argv[])
 {
     QApplication app(argc, argv);
     GLTiger window;
+
+    QStringList args = app.arguments();
+    int budget = args.indexOf("--texture-budget");
+    if (budget > 0 && budget + 1 < args.count())
+        window.setTextureBudget(args.at(budget + 1).toInt());
+    int diskBudget = args.indexOf("--disk-cache-budget");
+    if (diskBudget > 0 && diskBudget + 1 < args.count())
+        window.setDiskCacheBudget(args.at(diskBudget + 1).toInt());
+
+    // Benchmark mode: --benchmark [trajectory] [--save file] [--compare file]
+    // [--threshold percent]. The disk cache stays off for cold numbers,
+    // unless a budget is given. For a software GL context, run it with
+    // LIBGL_ALWAYS_SOFTWARE=1, under Xvfb where there is no display.
+    int benchmark = args.indexOf("--benchmark");
+    if (benchmark > 0) {
+        BenchmarkSettings settings;
+        for (int i = 1; i < args.count(); ++i) {
+            QString arg = args.at(i);
+            if (arg == "--save" && i + 1 < args.count())
+                settings.saveFile = args.at(++i);
+            else if (arg == "--compare" && i + 1 < args.count())
+                settings.compareFile = args.at(++i);
+            else if (arg == "--threshold" && i + 1 < args.count())
+                settings.threshold = args.at(++i).toDouble();
+            else if (i == benchmark + 1 && !arg.startsWith("--"))
+                settings.trajectoryFile = arg;
+        }
+
+        QList<BenchmarkStep> steps = defaultTrajectory();
+        if (!settings.trajectoryFile.isEmpty()) {
+            bool ok;
+            steps = loadTrajectory(settings.trajectoryFile, &ok);
+            if (!ok)
+                return 1;
+        }
+        if (diskBudget < 0)
+            window.setDiskCacheBudget(0);
+
+        window.resize(640, 480);
+        window.show();
+        BenchmarkResult result = window.runBenchmark(steps);
+        return reportBenchmark(result, settings) != 0 ? 1 : 0;
+    }
+
     window.resize(640, 480);
     window.show();
     return app.exec();
@@ -1,3 +1,4 @@
-SOURCES = backingstore.cpp
+SOURCES = backingstore.cpp svgdisplaylist.cpp textureatlas.cpp texturebuffer.cpp tilebenchmark.cpp tilecache.cpp tileprefetcher.cpp tilepyramid.cpp tilerenderer.cpp tilescheduler.cpp tileuploader.cpp
+HEADERS = svgdisplaylist.h textureatlas.h texturebuffer.h tilebenchmark.h tilecache.h tileprefetcher.h tilepyramid.h tilerenderer.h tilescheduler.h tileuploader.h
 RESOURCES = tiger.qrc
 QT += svg opengl
@@ -0,0 +1,439 @@
+/*
+    This file is part of the Ofi Labs X2 project.
+
+    Copyright (C) 2011 Ariya Hidayat <ariya.hidayat@gmail.com>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of
+    the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "svgdisplaylist.h"
+
+#include <QPaintDevice>
+#include <QPaintEngine>
+#include <QPainter>
+#include <QPixmap>
+#include <QSvgRenderer>
+#include <QtAlgorithms>
+#include <qmath.h>
+
+// Cells of the spatial index along each side of the document.
+const int GridDim = 32;
+
+// Claims every feature so that QPainter hands over paths, transformation
+// and state untouched, the clip included. Everything ends up in drawPath(),
+// drawPolygon() or drawPixmap(): the default implementations of the other
+// functions (rectangles, ellipses, lines, text) go through those.
+class SvgRecordingEngine: public QPaintEngine
+{
+public:
+    SvgRecordingEngine(SvgDisplayList *list);
+
+    bool begin(QPaintDevice *device);
+    bool end();
+    void updateState(const QPaintEngineState &state);
+    void drawPath(const QPainterPath &path);
+    void drawPolygon(const QPointF *points, int pointCount, PolygonDrawMode mode);
+    void drawPixmap(const QRectF &target, const QPixmap &pixmap, const QRectF &source);
+    void drawImage(const QRectF &target, const QImage &image, const QRectF &source,
+                   Qt::ImageConversionFlags flags);
+    Type type() const;
+
+private:
+    void record(const QPainterPath &path, const QBrush &brush);
+    void record(const QRectF &target, const QImage &image, const QRectF &source);
+    void updateClip(const QPainterPath &path, Qt::ClipOperation operation);
+    void setState(SvgDisplayList::Item *item) const;
+
+    SvgDisplayList *m_list;
+    QTransform m_transform;
+    QPen m_pen;
+    QBrush m_brush;
+    qreal m_opacity;
+    QPainter::RenderHints m_hints;
+    QPainter::CompositionMode m_compositionMode;
+    QPointF m_brushOrigin;
+    // The clip in document coordinates, whether there is one and whether
+    // it is enabled.
+    QPainterPath m_clip;
+    bool m_hasClip;
+    bool m_clipEnabled;
+};
+
+class SvgRecordingDevice: public QPaintDevice
+{
+public:
+    SvgRecordingDevice(SvgDisplayList *list, const QSize &size);
+    QPaintEngine *paintEngine() const;
+
+protected:
+    int metric(PaintDeviceMetric metric) const;
+
+private:
+    QSize m_size;
+    mutable SvgRecordingEngine m_engine;
+};
+
+SvgRecordingEngine::SvgRecordingEngine(SvgDisplayList *list)
+    : QPaintEngine(QPaintEngine::AllFeatures)
+    , m_list(list)
+    , m_opacity(1)
+    , m_hints(0)
+    , m_compositionMode(QPainter::CompositionMode_SourceOver)
+    , m_hasClip(false)
+    , m_clipEnabled(true)
+{
+}
+
+bool SvgRecordingEngine::begin(QPaintDevice *)
+{
+    return true;
+}
+
+bool SvgRecordingEngine::end()
+{
+    return true;
+}
+
+void SvgRecordingEngine::updateState(const QPaintEngineState &state)
+{
+    QPaintEngine::DirtyFlags flags = state.state();
+    if (flags & DirtyTransform)
+        m_transform = state.transform();
+    if (flags & DirtyPen)
+        m_pen = state.pen();
+    if (flags & DirtyBrush)
+        m_brush = state.brush();
+    if (flags & DirtyOpacity)
+        m_opacity = state.opacity();
+    if (flags & DirtyHints)
+        m_hints = state.renderHints();
+    if (flags & DirtyCompositionMode)
+        m_compositionMode = state.compositionMode();
+    if (flags & DirtyBrushOrigin)
+        m_brushOrigin = state.brushOrigin();
+
+    // The clip comes with the transformation it was set with, which is not
+    // necessarily the current one (QPainter::restore() replays the clips).
+    if (flags & DirtyClipPath)
+        updateClip(state.transform().map(state.clipPath()), state.clipOperation());
+    if (flags & DirtyClipRegion) {
+        QPainterPath path;
+        path.addRegion(state.clipRegion());
+        updateClip(state.transform().map(path), state.clipOperation());
+    }
+    if (flags & DirtyClipEnabled)
+        m_clipEnabled = state.isClipEnabled();
+}
+
+void SvgRecordingEngine::updateClip(const QPainterPath &path, Qt::ClipOperation operation)
+{
+    switch (operation) {
+    case Qt::NoClip:
+        m_clip = QPainterPath();
+        m_hasClip = false;
+        return;
+    case Qt::IntersectClip:
+        m_clip = m_hasClip ? m_clip.intersected(path) : path;
+        break;
+    case Qt::UniteClip:
+        m_clip = m_hasClip ? m_clip.united(path) : path;
+        break;
+    default:
+        m_clip = path;
+        break;
+    }
+    m_hasClip = true;
+}
+
+void SvgRecordingEngine::drawPath(const QPainterPath &path)
+{
+    record(path, m_brush);
+}
+
+// Polylines are only stroked, never filled.
+void SvgRecordingEngine::drawPolygon(const QPointF *points, int pointCount, PolygonDrawMode mode)
+{
+    if (pointCount < 2)
+        return;
+    QPainterPath path(points[0]);
+    for (int i = 1; i < pointCount; ++i)
+        path.lineTo(points[i]);
+    if (mode != PolylineMode)
+        path.closeSubpath();
+    path.setFillRule(mode == WindingMode ? Qt::WindingFill : Qt::OddEvenFill);
+    record(path, mode == PolylineMode ? QBrush() : m_brush);
+}
+
+// Pixmaps can not be used outside the GUI thread, images can.
+void SvgRecordingEngine::drawPixmap(const QRectF &target, const QPixmap &pixmap, const QRectF &source)
+{
+    record(target, pixmap.toImage(), source);
+}
+
+void SvgRecordingEngine::drawImage(const QRectF &target, const QImage &image, const QRectF &source,
+                                   Qt::ImageConversionFlags)
+{
+    record(target, image, source);
+}
+
+QPaintEngine::Type SvgRecordingEngine::type() const
+{
+    return QPaintEngine::User;
+}
+
+// Everything but the pen and the brush, which depend on the item.
+void SvgRecordingEngine::setState(SvgDisplayList::Item *item) const
+{
+    item->transform = m_transform;
+    item->opacity = m_opacity;
+    item->hints = m_hints;
+    item->compositionMode = m_compositionMode;
+    item->brushOrigin = m_brushOrigin;
+    item->clipped = m_hasClip && m_clipEnabled;
+    if (item->clipped) {
+        item->clip = m_clip;
+        item->bounds &= m_clip.boundingRect();
+    }
+}
+
+// The bounding box accounts for the stroke. Miter joins may reach as far
+// as the miter limit, cosmetic pens one pixel whatever the scale. Nothing
+// is drawn outside the clip either.
+void SvgRecordingEngine::record(const QPainterPath &path, const QBrush &brush)
+{
+    if (path.isEmpty())
+        return;
+    if (m_pen.style() == Qt::NoPen && brush.style() == Qt::NoBrush)
+        return;
+
+    SvgDisplayList::Item item;
+    item.pen = m_pen;
+    item.brush = brush;
+    item.path = path;
+
+    QRectF bounds = path.controlPointRect();
+    if (m_pen.style() != Qt::NoPen && !m_pen.isCosmetic()) {
+        qreal margin = m_pen.widthF() * qMax(m_pen.miterLimit(), qreal(1)) / 2;
+        bounds.adjust(-margin, -margin, margin, margin);
+    }
+    item.bounds = m_transform.mapRect(bounds);
+    if (m_pen.style() != Qt::NoPen && m_pen.isCosmetic())
+        item.bounds.adjust(-1, -1, 1, 1);
+
+    setState(&item);
+    if (!item.bounds.isEmpty())
+        m_list->addItem(item);
+}
+
+void SvgRecordingEngine::record(const QRectF &target, const QImage &image, const QRectF &source)
+{
+    if (image.isNull())
+        return;
+
+    SvgDisplayList::Item item;
+    item.image = image;
+    item.target = target;
+    item.source = source;
+    item.bounds = m_transform.mapRect(target);
+    setState(&item);
+    if (!item.bounds.isEmpty())
+        m_list->addItem(item);
+}
+
+SvgRecordingDevice::SvgRecordingDevice(SvgDisplayList *list, const QSize &size)
+    : m_size(size)
+    , m_engine(list)
+{
+}
+
+QPaintEngine *SvgRecordingDevice::paintEngine() const
+{
+    return &m_engine;
+}
+
+int SvgRecordingDevice::metric(PaintDeviceMetric metric) const
+{
+    switch (metric) {
+    case PdmWidth:
+        return m_size.width();
+    case PdmHeight:
+        return m_size.height();
+    case PdmWidthMM:
+        return m_size.width() * 254 / 720;
+    case PdmHeightMM:
+        return m_size.height() * 254 / 720;
+    case PdmNumColors:
+        return 0xffffffff;
+    case PdmDepth:
+        return 32;
+    case PdmDpiX:
+    case PdmDpiY:
+    case PdmPhysicalDpiX:
+    case PdmPhysicalDpiY:
+        return 72;
+    }
+    return 0;
+}
+
+SvgDisplayList::SvgDisplayList(QSvgRenderer *svg)
+    : m_size(svg->defaultSize())
+{
+    SvgRecordingDevice device(this, m_size);
+    QPainter painter(&device);
+    painter.setRenderHint(QPainter::Antialiasing, true);
+    svg->render(&painter, QRect(QPoint(0, 0), m_size));
+    painter.end();
+
+    buildIndex();
+}
+
+// Assigning a path keeps sharing its data, rebuilding it does not.
+static QPainterPath detachedPath(const QPainterPath &path)
+{
+    QPainterPath copy;
+    copy.setFillRule(path.fillRule());
+    for (int i = 0; i < path.elementCount(); ++i) {
+        const QPainterPath::Element &e = path.elementAt(i);
+        switch (e.type) {
+        case QPainterPath::MoveToElement:
+            copy.moveTo(e.x, e.y);
+            break;
+        case QPainterPath::LineToElement:
+            copy.lineTo(e.x, e.y);
+            break;
+        case QPainterPath::CurveToElement:
+            copy.cubicTo(e.x, e.y, path.elementAt(i + 1).x, path.elementAt(i + 1).y,
+                         path.elementAt(i + 2).x, path.elementAt(i + 2).y);
+            i += 2;
+            break;
+        default:
+            break;
+        }
+    }
+    return copy;
+}
+
+// Setting a property detaches pens and brushes, even to the same value.
+SvgDisplayList *SvgDisplayList::clone() const
+{
+    SvgDisplayList *list = new SvgDisplayList(*this);
+    for (int i = 0; i < list->m_items.count(); ++i) {
+        Item &item = list->m_items[i];
+        item.path = detachedPath(item.path);
+        item.clip = detachedPath(item.clip);
+        item.pen.setWidthF(item.pen.widthF());
+        item.brush.setTransform(item.brush.transform());
+        if (!item.image.isNull())
+            item.image = item.image.copy();
+    }
+    return list;
+}
+
+QSize SvgDisplayList::size() const
+{
+    return m_size;
+}
+
+int SvgDisplayList::itemCount() const
+{
+    return m_items.count();
+}
+
+// The candidates of every cell are merged, sorted to get the original
+// order back (it matters for overlapping items) and deduplicated.
+void SvgDisplayList::draw(QPainter *painter, const QRectF &area) const
+{
+    QRect range = cells(area);
+    if (range.isEmpty())
+        return;
+
+    QVector<int> candidates;
+    for (int y = range.top(); y <= range.bottom(); ++y)
+        for (int x = range.left(); x <= range.right(); ++x)
+            candidates += m_grid.at(y * GridDim + x);
+    qSort(candidates.begin(), candidates.end());
+
+    QTransform base = painter->worldTransform();
+    painter->save();
+    int previous = -1;
+    for (int i = 0; i < candidates.count(); ++i) {
+        int index = candidates.at(i);
+        if (index == previous)
+            continue;
+        previous = index;
+
+        const Item &item = m_items.at(index);
+        if (!item.bounds.intersects(area))
+            continue;
+
+        // The clip adds to the one of the painter, if any, for this item
+        // only.
+        if (item.clipped) {
+            painter->save();
+            painter->setWorldTransform(base);
+            painter->setClipPath(item.clip, Qt::IntersectClip);
+        }
+        painter->setWorldTransform(item.transform * base);
+        painter->setOpacity(item.opacity);
+        if (painter->renderHints() != item.hints) {
+            painter->setRenderHints(painter->renderHints() & ~item.hints, false);
+            painter->setRenderHints(item.hints, true);
+        }
+        painter->setCompositionMode(item.compositionMode);
+        painter->setBrushOrigin(item.brushOrigin);
+        if (item.image.isNull()) {
+            painter->setPen(item.pen);
+            painter->setBrush(item.brush);
+            painter->drawPath(item.path);
+        } else {
+            painter->drawImage(item.target, item.image, item.source);
+        }
+        if (item.clipped)
+            painter->restore();
+    }
+    painter->restore();
+}
+
+void SvgDisplayList::addItem(const Item &item)
+{
+    m_items += item;
+}
+
+// The grid covers the document and whatever is drawn outside of it.
+void SvgDisplayList::buildIndex()
+{
+    m_gridBounds = QRectF(QPointF(0, 0), QSizeF(m_size));
+    for (int i = 0; i < m_items.count(); ++i)
+        m_gridBounds |= m_items.at(i).bounds;
+    m_cellSize = QSizeF(m_gridBounds.width() / GridDim, m_gridBounds.height() / GridDim);
+
+    m_grid.resize(GridDim * GridDim);
+    for (int i = 0; i < m_items.count(); ++i) {
+        QRect range = cells(m_items.at(i).bounds);
+        for (int y = range.top(); y <= range.bottom(); ++y)
+            for (int x = range.left(); x <= range.right(); ++x)
+                m_grid[y * GridDim + x] += i;
+    }
+}
+
+QRect SvgDisplayList::cells(const QRectF &area) const
+{
+    if (m_cellSize.isEmpty())
+        return QRect();
+    int x1 = qFloor((area.left() - m_gridBounds.left()) / m_cellSize.width());
+    int y1 = qFloor((area.top() - m_gridBounds.top()) / m_cellSize.height());
+    int x2 = qFloor((area.right() - m_gridBounds.left()) / m_cellSize.width());
+    int y2 = qFloor((area.bottom() - m_gridBounds.top()) / m_cellSize.height());
+    return QRect(QPoint(x1, y1), QPoint(x2, y2)) & QRect(0, 0, GridDim, GridDim);
+}
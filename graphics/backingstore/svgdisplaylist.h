@@ -0,0 +1,99 @@
+/*
+    This file is part of the Ofi Labs X2 project.
+
+    Copyright (C) 2011 Ariya Hidayat <ariya.hidayat@gmail.com>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of
+    the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef OFILABS_SVGDISPLAYLIST
+#define OFILABS_SVGDISPLAYLIST
+
+#include <QBrush>
+#include <QImage>
+#include <QPainter>
+#include <QPainterPath>
+#include <QPen>
+#include <QPointF>
+#include <QRectF>
+#include <QSize>
+#include <QTransform>
+#include <QVector>
+
+class QSvgRenderer;
+
+// The document of a QSvgRenderer, recorded once as a flat list of paths
+// (and images) along with their transformation, pen, brush, clip, render
+// hints, composition mode, brush origin and bounding box. A uniform grid
+// over the document indexes the items, thus drawing a small area only goes
+// through the items which intersect it, instead of walking and
+// re-tessellating the whole document.
+//
+// The document is recorded with antialiasing on, as tiles are rendered,
+// and the hints of every item replace those of the painter.
+//
+// Once recorded, the list is never modified. Still, a QPainterPath fills
+// in some of its data lazily when first drawn, inside its shared private
+// data. A thread must thus only draw its own list, see clone().
+class SvgDisplayList
+{
+public:
+    // Records the document as rendered into a rectangle of its default size.
+    SvgDisplayList(QSvgRenderer *svg);
+
+    // A copy sharing no path, pen, brush or image with this list, to be
+    // drawn from another thread. Make it before any of them draws.
+    SvgDisplayList *clone() const;
+
+    QSize size() const;
+    int itemCount() const;
+
+    // Draws the items which intersect the area, given in document
+    // coordinates, with the transformation of the painter.
+    void draw(QPainter *painter, const QRectF &area) const;
+
+private:
+    friend class SvgRecordingEngine;
+
+    struct Item {
+        QTransform transform;
+        QPen pen;
+        QBrush brush;
+        qreal opacity;
+        QPainter::RenderHints hints;
+        QPainter::CompositionMode compositionMode;
+        QPointF brushOrigin;
+        // In document coordinates, only used when clipped is set.
+        bool clipped;
+        QPainterPath clip;
+        QPainterPath path;
+        QImage image;
+        QRectF target;
+        QRectF source;
+        QRectF bounds;
+    };
+
+    void addItem(const Item &item);
+    void buildIndex();
+    QRect cells(const QRectF &area) const;
+
+    QSize m_size;
+    QVector<Item> m_items;
+
+    QRectF m_gridBounds;
+    QSizeF m_cellSize;
+    QVector<QVector<int> > m_grid;
+};
+
+#endif
@@ -0,0 +1,184 @@
+/*
+    This file is part of the Ofi Labs X2 project.
+
+    Copyright (C) 2011 Ariya Hidayat <ariya.hidayat@gmail.com>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of
+    the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "textureatlas.h"
+#include "texturebuffer.h"
+
+// gl.h on Windows is OpenGL 1.1, none of these is there.
+#ifndef GL_CLAMP_TO_EDGE
+#define GL_CLAMP_TO_EDGE 0x812F
+#endif
+#ifndef GL_BGRA
+#define GL_BGRA 0x80E1
+#endif
+#ifndef GL_UNSIGNED_INT_8_8_8_8_REV
+#define GL_UNSIGNED_INT_8_8_8_8_REV 0x8367
+#endif
+
+// Largest page, if the implementation permits. It holds 256 tiles.
+const int MaxPageDim = 2048;
+
+TextureAtlas::TextureAtlas()
+    : m_pageDim(0)
+    , m_cellsPerRow(0)
+    , m_cellsPerPage(0)
+    , m_residentPages(0)
+{
+}
+
+// Within a page, the most recently released slots are reused first.
+int TextureAtlas::allocate()
+{
+    int page = 0;
+    while (page < m_pages.count() && (m_pages.at(page) == 0 || m_freeSlots.at(page).isEmpty()))
+        ++page;
+    if (page == m_pages.count())
+        page = addPage();
+
+    QVector<int> &freeSlots = m_freeSlots[page];
+    int slot = freeSlots.last();
+    freeSlots.removeLast();
+    ++m_usedSlots[page];
+    return slot;
+}
+
+void TextureAtlas::release(int slot)
+{
+    if (slot <= 0)
+        return;
+    m_freeSlots[page(slot)] += slot;
+    --m_usedSlots[page(slot)];
+}
+
+void TextureAtlas::upload(int slot, const QImage &tile)
+{
+    int cell = (slot - 1) % m_cellsPerPage;
+    int x = (cell % m_cellsPerRow) * TileDim;
+    int y = (cell / m_cellsPerRow) * TileDim;
+
+    QImage image = tile;
+    if (image.format() != QImage::Format_ARGB32 && image.format() != QImage::Format_ARGB32_Premultiplied)
+        image = image.convertToFormat(QImage::Format_ARGB32);
+
+    m_uploader.upload(texture(page(slot)), x, y, image);
+}
+
+int TextureAtlas::pageCount() const
+{
+    return m_pages.count();
+}
+
+int TextureAtlas::page(int slot) const
+{
+    return (slot - 1) / m_cellsPerPage;
+}
+
+GLuint TextureAtlas::texture(int page) const
+{
+    return m_pages.value(page);
+}
+
+// The image is not flipped, i.e. its top row is at the top of the cell.
+QRectF TextureAtlas::textureRect(int slot) const
+{
+    int cell = (slot - 1) % m_cellsPerPage;
+    qreal dim = qreal(TileDim) / m_pageDim;
+    return QRectF((cell % m_cellsPerRow) * dim, (cell / m_cellsPerRow) * dim, dim, dim);
+}
+
+const TileUploader &TextureAtlas::uploader() const
+{
+    return m_uploader;
+}
+
+void TextureAtlas::releaseEmptyPages()
+{
+    for (int page = 0; page < m_pages.count(); ++page) {
+        if (m_pages.at(page) != 0 && m_usedSlots.at(page) == 0) {
+            glDeleteTextures(1, &m_pages.at(page));
+            m_pages[page] = 0;
+            m_freeSlots[page].clear();
+            --m_residentPages;
+        }
+    }
+}
+
+int TextureAtlas::residentPageCount() const
+{
+    return m_residentPages;
+}
+
+qint64 TextureAtlas::memoryUsage() const
+{
+    return qint64(m_residentPages) * m_pageDim * m_pageDim * 4;
+}
+
+void TextureAtlas::clear()
+{
+    for (int page = 0; page < m_pages.count(); ++page)
+        if (m_pages.at(page) != 0)
+            glDeleteTextures(1, &m_pages.at(page));
+    m_pages.clear();
+    m_usedSlots.clear();
+    m_freeSlots.clear();
+    m_residentPages = 0;
+}
+
+// Takes the first deleted page number, if any.
+int TextureAtlas::addPage()
+{
+    if (m_pageDim == 0) {
+        GLint maxSize = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+        m_pageDim = qMax(TileDim, qMin(MaxPageDim, int(maxSize)) / TileDim * TileDim);
+        m_cellsPerRow = m_pageDim / TileDim;
+        m_cellsPerPage = m_cellsPerRow * m_cellsPerRow;
+    }
+
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, m_pageDim, m_pageDim, 0,
+                 GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, 0);
+
+    // Tiles are drawn pixel-aligned or scaled without filtering, hence
+    // neighbor cells never bleed into each other.
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    int page = m_pages.indexOf(0);
+    if (page < 0) {
+        page = m_pages.count();
+        m_pages += 0;
+        m_usedSlots += 0;
+        m_freeSlots += QVector<int>();
+    }
+    m_pages[page] = texture;
+    ++m_residentPages;
+
+    // Slots of the new page, the first cell ends up at the end of the
+    // list to be handed out first.
+    QVector<int> &freeSlots = m_freeSlots[page];
+    int first = page * m_cellsPerPage + 1;
+    for (int slot = first + m_cellsPerPage - 1; slot >= first; --slot)
+        freeSlots += slot;
+    return page;
+}
@@ -0,0 +1,80 @@
+/*
+    This file is part of the Ofi Labs X2 project.
+
+    Copyright (C) 2011 Ariya Hidayat <ariya.hidayat@gmail.com>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of
+    the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef OFILABS_TEXTUREATLAS
+#define OFILABS_TEXTUREATLAS
+
+#include <QGLWidget>
+#include <QImage>
+#include <QRectF>
+#include <QVector>
+
+#include "tileuploader.h"
+
+// Tiles stored as cells of a few large textures (pages), so that all the
+// tiles of a page can be drawn with a single call. A tile is identified
+// by its slot, 0 being no slot at all.
+//
+// Pages are created on demand. Slots are handed out from the first page
+// with room, so that tiles pack into the lowest pages and the last ones
+// empty out as tiles are released; releaseEmptyPages() then deletes their
+// textures. Their numbers stay reserved and are reused before adding new
+// ones, thus slots keep their page. Every call needs the GL context to be
+// current.
+class TextureAtlas
+{
+public:
+    TextureAtlas();
+
+    int allocate();
+    void release(int slot);
+    void upload(int slot, const QImage &tile);
+
+    // Page numbers in use so far, a deleted page has no texture.
+    int pageCount() const;
+    int page(int slot) const;
+    GLuint texture(int page) const;
+
+    void releaseEmptyPages();
+    // Pages with a texture, and the texture memory they take, in bytes.
+    int residentPageCount() const;
+    qint64 memoryUsage() const;
+
+    // Area of the slot within its page, in texture coordinates.
+    QRectF textureRect(int slot) const;
+
+    const TileUploader &uploader() const;
+
+    // Deletes every page.
+    void clear();
+
+private:
+    int addPage();
+
+    int m_pageDim;
+    int m_cellsPerRow;
+    int m_cellsPerPage;
+    QVector<GLuint> m_pages;
+    QVector<int> m_usedSlots;
+    QVector<QVector<int> > m_freeSlots;
+    int m_residentPages;
+    TileUploader m_uploader;
+};
+
+#endif
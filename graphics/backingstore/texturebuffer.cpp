@@ -0,0 +1,203 @@
+/*
+    This file is part of the Ofi Labs X2 project.
+
+    Copyright (C) 2011 Ariya Hidayat <ariya.hidayat@gmail.com>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of
+    the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "texturebuffer.h"
+#include "textureatlas.h"
+
+#include <qmath.h>
+
+TextureBuffer::TextureBuffer(TextureAtlas *atlas)
+    : zoomFactor(0.1)
+    , atlas(atlas)
+{
+}
+
+bool TextureBuffer::isEmpty() const
+{
+    return tiles.isEmpty();
+}
+
+void TextureBuffer::clear()
+{
+    for (int i = 0; i < tiles.count(); ++i)
+        if (tiles.at(i) != 0 && atlas)
+            atlas->release(tiles.at(i));
+    tiles.clear();
+    bufferSize = QSize(0, 0);
+}
+
+int TextureBuffer::at(int x, int y) const
+{
+    int index = y * bufferSize.width() + x;
+    if (index < 0 || index >= tiles.count())
+        return 0;
+    return tiles.at(index);
+}
+
+// Note: does not release the existing slot!
+void TextureBuffer::replace(int x, int y, int slot)
+{
+    int index = y * bufferSize.width() + x;
+    if (index < 0 || index >= tiles.count())
+        return;
+    tiles[index] = slot;
+}
+
+void TextureBuffer::remove(int x, int y)
+{
+    int index = y * bufferSize.width() + x;
+    if (index < 0 || index >= tiles.count())
+        return;
+    if (tiles.at(index) != 0) {
+        if (atlas)
+            atlas->release(tiles.at(index));
+        tiles[index] = 0;
+    }
+}
+
+int TextureBuffer::width() const
+{
+    return bufferSize.width();
+}
+
+int TextureBuffer::height() const
+{
+    return bufferSize.height();
+}
+
+void TextureBuffer::resize(int w, int h)
+{
+    bufferSize = QSize(w, h);
+    tiles.resize(w * h);
+    tiles.fill(0);
+}
+
+// Each tile is a textured quad: texture coordinates, then position.
+static void appendQuad(QVector<GLfloat> &vertices, int x, int y, const QRectF &texture)
+{
+    GLfloat tx = x * TileDim;
+    GLfloat ty = y * TileDim;
+    GLfloat quad[] = {
+        GLfloat(texture.left()), GLfloat(texture.top()), tx, ty,
+        GLfloat(texture.right()), GLfloat(texture.top()), tx + TileDim, ty,
+        GLfloat(texture.right()), GLfloat(texture.bottom()), tx + TileDim, ty + TileDim,
+        GLfloat(texture.left()), GLfloat(texture.bottom()), tx, ty + TileDim
+    };
+    for (int i = 0; i < 16; ++i)
+        vertices += quad[i];
+}
+
+static void drawQuads(GLuint texture, const QVector<GLfloat> &vertices)
+{
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexCoordPointer(2, GL_FLOAT, 4 * sizeof(GLfloat), vertices.constData());
+    glVertexPointer(2, GL_FLOAT, 4 * sizeof(GLfloat), vertices.constData() + 2);
+    glDrawArrays(GL_QUADS, 0, vertices.count() / 4);
+}
+
+// Plain client-side vertex arrays: this is OpenGL 1.1, available anywhere
+// including software implementations.
+void TextureBuffer::draw(const QRect &range) const
+{
+    if (!atlas)
+        return;
+
+    QRect clipped = range & QRect(0, 0, bufferSize.width(), bufferSize.height());
+    QVector<QVector<GLfloat> > pages(atlas->pageCount());
+    for (int y = clipped.top(); y <= clipped.bottom(); ++y) {
+        for (int x = clipped.left(); x <= clipped.right(); ++x) {
+            int slot = at(x, y);
+            if (slot != 0)
+                appendQuad(pages[atlas->page(slot)], x, y, atlas->textureRect(slot));
+        }
+    }
+
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    for (int page = 0; page < pages.count(); ++page)
+        if (!pages.at(page).isEmpty())
+            drawQuads(atlas->texture(page), pages.at(page));
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+}
+
+// The substitute comes from QGLWidget::bindTexture(), which flips the
+// image vertically.
+int TextureBuffer::drawMissing(const QRect &range, GLuint substitute) const
+{
+    QRect clipped = range & QRect(0, 0, bufferSize.width(), bufferSize.height());
+    QVector<GLfloat> vertices;
+    for (int y = clipped.top(); y <= clipped.bottom(); ++y)
+        for (int x = clipped.left(); x <= clipped.right(); ++x)
+            if (at(x, y) == 0)
+                appendQuad(vertices, x, y, QRectF(0, 1, 1, -1));
+
+    if (vertices.isEmpty() || substitute == 0)
+        return vertices.count() / 16;
+
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    drawQuads(substitute, vertices);
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+
+    return vertices.count() / 16;
+}
+
+void TextureBuffer::setViewModelMatrix(const QPointF &viewOffset, qreal viewZoomFactor) const
+{
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+    glTranslatef(viewOffset.x(), viewOffset.y(), 0);
+    glScalef(viewZoomFactor / zoomFactor, viewZoomFactor / zoomFactor, 1);
+}
+
+QRect TextureBuffer::visibleRange(const QPointF &viewOffset,
+    qreal viewZoomFactor, const QSize &viewSize) const
+{
+    qreal dim = TileDim * viewZoomFactor / zoomFactor;
+
+    int tx1 = -viewOffset.x() / dim;
+    int tx2 = (viewSize.width() -viewOffset.x()) / dim;
+    int ty1 = -viewOffset.y() / dim;
+    int ty2 = (viewSize.height() - viewOffset.y()) / dim;
+
+    tx1 = qMax(0, tx1);
+    tx2 = qMin(bufferSize.width() - 1, tx2);
+    ty1 = qMax(0, ty1);
+    ty2 = qMin(bufferSize.height() - 1, ty2);
+
+    return QRect(QPoint(tx1, ty1), QPoint(tx2, ty2));
+}
+
+// Tiles are rendered with an extra pixel for the antialiased edges, the
+// neighbours of the area are affected too.
+QRect TextureBuffer::tileRange(const QRectF &area) const
+{
+    qreal pixel = 1 / zoomFactor;
+    qreal extent = TileDim / zoomFactor;
+    QRectF inflated = area.adjusted(-pixel, -pixel, pixel, pixel);
+
+    int tx1 = qFloor(inflated.left() / extent);
+    int tx2 = qFloor(inflated.right() / extent);
+    int ty1 = qFloor(inflated.top() / extent);
+    int ty2 = qFloor(inflated.bottom() / extent);
+
+    return QRect(QPoint(tx1, ty1), QPoint(tx2, ty2)) & QRect(0, 0, bufferSize.width(), bufferSize.height());
+}
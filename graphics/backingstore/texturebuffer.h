@@ -0,0 +1,73 @@
+/*
+    This file is part of the Ofi Labs X2 project.
+
+    Copyright (C) 2011 Ariya Hidayat <ariya.hidayat@gmail.com>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of
+    the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef OFILABS_TEXTUREBUFFER
+#define OFILABS_TEXTUREBUFFER
+
+#include <QGLWidget>
+#include <QPointF>
+#include <QRect>
+#include <QRectF>
+#include <QSize>
+#include <QVector>
+
+class TextureAtlas;
+
+const int TileDim = 128;
+
+// A grid of tiles rendered at a given zoom. The tiles live in the slots
+// of a texture atlas, possibly shared with other buffers.
+class TextureBuffer
+{
+public:
+    qreal zoomFactor;
+
+    TextureBuffer(TextureAtlas *atlas = 0);
+
+    bool isEmpty() const;
+    void clear();
+
+    // The atlas slot of the tile, 0 if there is none.
+    int at(int x, int y) const;
+    void replace(int x, int y, int slot);
+    void remove(int x, int y);
+
+    int width() const;
+    int height() const;
+    void resize(int w, int h);
+
+    // Draws every tile of the range, with one call per atlas page.
+    void draw(const QRect &range) const;
+    // Draws the substitute texture where tiles of the range are missing,
+    // and returns how many.
+    int drawMissing(const QRect &range, GLuint substitute) const;
+
+    void setViewModelMatrix(const QPointF &viewOffset, qreal viewZoomFactor) const;
+    QRect visibleRange(const QPointF &viewOffset, qreal viewZoomFactor,
+                     const QSize &viewSize) const;
+    // Tiles covering an area of the document, at zoom factor 1.
+    QRect tileRange(const QRectF &area) const;
+
+private:
+    TextureAtlas *atlas;
+    QVector<int> tiles;
+    QSize bufferSize;
+};
+
+#endif
@@ -0,0 +1,261 @@
+/*
+    This file is part of the Ofi Labs X2 project.
+
+    Copyright (C) 2011 Ariya Hidayat <ariya.hidayat@gmail.com>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of
+    the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "tilebenchmark.h"
+
+#include <QFile>
+#include <QHash>
+#include <QStringList>
+#include <QTextStream>
+#include <QtAlgorithms>
+
+#include <stdio.h>
+
+BenchmarkResult::BenchmarkResult()
+    : incompleteViewports(0)
+    , tilesRendered(0)
+    , tilesWasted(0)
+    , texturePeak(0)
+{
+}
+
+BenchmarkSettings::BenchmarkSettings()
+    : threshold(10)
+{
+}
+
+static BenchmarkStep createStep(BenchmarkStep::Type type, int duration)
+{
+    BenchmarkStep step;
+    step.type = type;
+    step.duration = duration;
+    step.delta = QPointF(0, 0);
+    step.factor = 1;
+    step.center = QPoint(0, 0);
+    return step;
+}
+
+QList<BenchmarkStep> loadTrajectory(const QString &fileName, bool *ok)
+{
+    QList<BenchmarkStep> steps;
+    *ok = false;
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        fprintf(stderr, "Can not read %s\n", qPrintable(fileName));
+        return steps;
+    }
+
+    QTextStream stream(&file);
+    for (int lineNumber = 1; !stream.atEnd(); ++lineNumber) {
+        QString line = stream.readLine().trimmed();
+        if (line.isEmpty() || line.startsWith('#'))
+            continue;
+        QStringList fields = line.split(' ', QString::SkipEmptyParts);
+        QString command = fields.at(0);
+        int duration = fields.value(1).toInt();
+
+        if (command == "pan" && fields.count() == 4) {
+            BenchmarkStep step = createStep(BenchmarkStep::Pan, duration);
+            step.delta = QPointF(fields.at(2).toDouble(), fields.at(3).toDouble());
+            steps += step;
+        } else if (command == "zoom" && fields.count() == 5) {
+            BenchmarkStep step = createStep(BenchmarkStep::Zoom, duration);
+            step.factor = fields.at(2).toDouble();
+            step.center = QPoint(fields.at(3).toInt(), fields.at(4).toInt());
+            steps += step;
+        } else if (command == "wait" && fields.count() == 2) {
+            steps += createStep(BenchmarkStep::Wait, duration);
+        } else {
+            fprintf(stderr, "%s:%d: invalid step\n", qPrintable(fileName), lineNumber);
+            return QList<BenchmarkStep>();
+        }
+    }
+
+    *ok = true;
+    return steps;
+}
+
+// Slow and fast pans in every direction, zooming in twice and back out to
+// levels still in the pyramid.
+QList<BenchmarkStep> defaultTrajectory()
+{
+    QList<BenchmarkStep> steps;
+    BenchmarkStep step;
+
+    step = createStep(BenchmarkStep::Pan, 2000);
+    step.delta = QPointF(-600, 0);
+    steps += step;
+    step = createStep(BenchmarkStep::Pan, 500);
+    step.delta = QPointF(0, -400);
+    steps += step;
+
+    step = createStep(BenchmarkStep::Zoom, 1000);
+    step.factor = 2;
+    step.center = QPoint(320, 240);
+    steps += step;
+    step = createStep(BenchmarkStep::Pan, 1000);
+    step.delta = QPointF(800, 200);
+    steps += step;
+
+    step = createStep(BenchmarkStep::Zoom, 1000);
+    step.factor = 2;
+    step.center = QPoint(320, 240);
+    steps += step;
+    step = createStep(BenchmarkStep::Pan, 300);
+    step.delta = QPointF(-900, -300);
+    steps += step;
+    steps += createStep(BenchmarkStep::Wait, 500);
+
+    step = createStep(BenchmarkStep::Zoom, 1000);
+    step.factor = 0.5;
+    step.center = QPoint(320, 240);
+    steps += step;
+    step = createStep(BenchmarkStep::Zoom, 1000);
+    step.factor = 0.5;
+    step.center = QPoint(320, 240);
+    steps += step;
+    step = createStep(BenchmarkStep::Pan, 1500);
+    step.delta = QPointF(500, 500);
+    steps += step;
+
+    return steps;
+}
+
+// Nearest rank.
+static qint64 percentile(QVector<qint64> values, int p)
+{
+    if (values.isEmpty())
+        return 0;
+    qSort(values.begin(), values.end());
+    int rank = qBound(0, (values.count() * p + 99) / 100 - 1, values.count() - 1);
+    return values.at(rank);
+}
+
+static qint64 mean(const QVector<qint64> &values)
+{
+    if (values.isEmpty())
+        return 0;
+    qint64 sum = 0;
+    for (int i = 0; i < values.count(); ++i)
+        sum += values.at(i);
+    return sum / values.count();
+}
+
+static qint64 maximum(const QVector<qint64> &values)
+{
+    qint64 result = 0;
+    for (int i = 0; i < values.count(); ++i)
+        result = qMax(result, values.at(i));
+    return result;
+}
+
+// Baseline files hold one "metric value" line per metric. A file which
+// can not be read, or holds no metric at all, is an error.
+static bool loadBaseline(const QString &fileName, QHash<QString, double> *baseline)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        fprintf(stderr, "Can not read %s\n", qPrintable(fileName));
+        return false;
+    }
+    QTextStream stream(&file);
+    while (!stream.atEnd()) {
+        QString line = stream.readLine().trimmed();
+        if (line.isEmpty() || line.startsWith('#'))
+            continue;
+        QStringList fields = line.split(' ', QString::SkipEmptyParts);
+        if (fields.count() == 2)
+            (*baseline)[fields.at(0)] = fields.at(1).toDouble();
+    }
+    if (baseline->isEmpty()) {
+        fprintf(stderr, "No metric in %s\n", qPrintable(fileName));
+        return false;
+    }
+    return true;
+}
+
+// Every metric is better when lower, thus anything above a zero baseline
+// is a regression.
+int reportBenchmark(const BenchmarkResult &result, const BenchmarkSettings &settings)
+{
+    QList<QPair<QString, double> > metrics;
+    metrics += qMakePair(QString("frame_p50_ms"), percentile(result.frameTimes, 50) / 1e6);
+    metrics += qMakePair(QString("frame_p95_ms"), percentile(result.frameTimes, 95) / 1e6);
+    metrics += qMakePair(QString("frame_p99_ms"), percentile(result.frameTimes, 99) / 1e6);
+    metrics += qMakePair(QString("viewport_mean_ms"), double(mean(result.viewportTimes)));
+    metrics += qMakePair(QString("viewport_max_ms"), double(maximum(result.viewportTimes)));
+    metrics += qMakePair(QString("tiles_rendered"), double(result.tilesRendered));
+    metrics += qMakePair(QString("tiles_wasted"), double(result.tilesWasted));
+    metrics += qMakePair(QString("texture_peak_mb"), result.texturePeak / (1024.0 * 1024.0));
+
+    QHash<QString, double> baseline;
+    if (!settings.compareFile.isEmpty() && !loadBaseline(settings.compareFile, &baseline))
+        return -1;
+
+    QFile saveFile(settings.saveFile);
+    QTextStream save(&saveFile);
+    if (!settings.saveFile.isEmpty()) {
+        if (saveFile.open(QIODevice::WriteOnly | QIODevice::Text))
+            save << "# metric value\n";
+        else
+            fprintf(stderr, "Can not write %s\n", qPrintable(settings.saveFile));
+    }
+
+    printf("Backing store, %d frames, %d zoom level(s) reached", result.frameTimes.count(),
+           result.viewportTimes.count());
+    if (result.incompleteViewports > 0)
+        printf(", %d never completed", result.incompleteViewports);
+    printf("\n\nTime to full viewport (ms):");
+    for (int i = 0; i < result.viewportTimes.count(); ++i)
+        printf(" %lld", result.viewportTimes.at(i));
+    printf("\n\n%18s %12s %10s\n", "metric", "value", "baseline");
+
+    int regressions = 0;
+    for (int i = 0; i < metrics.count(); ++i) {
+        QString key = metrics.at(i).first;
+        double value = metrics.at(i).second;
+
+        QByteArray verdict;
+        if (baseline.contains(key) && baseline.value(key) > 0) {
+            double change = (value / baseline.value(key) - 1) * 100;
+            verdict = QString("%1%2%").arg(change >= 0 ? "+" : "").arg(change, 0, 'f', 1).toLatin1();
+            if (change > settings.threshold) {
+                verdict += " WORSE";
+                ++regressions;
+            }
+        } else if (baseline.contains(key)) {
+            verdict = "+0.0%";
+            if (value > 0) {
+                verdict = "was 0 WORSE";
+                ++regressions;
+            }
+        }
+
+        printf("%18s %12.3f %10s\n", qPrintable(key), value, verdict.constData());
+        if (saveFile.isOpen())
+            save << key << ' ' << QString::number(value, 'f', 4) << '\n';
+    }
+
+    if (!baseline.isEmpty()) {
+        printf("\n%d metric(s) more than %.1f%% worse than %s\n", regressions,
+               settings.threshold, qPrintable(settings.compareFile));
+    }
+    return regressions;
+}
@@ -0,0 +1,84 @@
+/*
+    This file is part of the Ofi Labs X2 project.
+
+    Copyright (C) 2011 Ariya Hidayat <ariya.hidayat@gmail.com>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of
+    the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef OFILABS_TILEBENCHMARK
+#define OFILABS_TILEBENCHMARK
+
+#include <QList>
+#include <QPoint>
+#include <QPointF>
+#include <QString>
+#include <QVector>
+
+// One step of a pan/zoom trajectory. A pan moves the view by the delta,
+// evenly over the duration. A zoom multiplies the zoom factor at once,
+// centered at a point of the view, then waits for the duration.
+struct BenchmarkStep
+{
+    enum Type { Pan, Zoom, Wait };
+    Type type;
+    int duration;
+    QPointF delta;
+    qreal factor;
+    QPoint center;
+};
+
+// Trajectory files have one step per line, in milliseconds and pixels:
+//
+//     pan <duration> <dx> <dy>
+//     zoom <duration> <factor> <x> <y>
+//     wait <duration>
+//
+// Empty lines and lines starting with '#' are ignored.
+QList<BenchmarkStep> loadTrajectory(const QString &fileName, bool *ok);
+QList<BenchmarkStep> defaultTrajectory();
+
+struct BenchmarkResult
+{
+    BenchmarkResult();
+
+    // Time spent in each frame, in nanoseconds.
+    QVector<qint64> frameTimes;
+    // Time until the view is covered by tiles of the right zoom, for the
+    // first view and after each zoom, in milliseconds.
+    QVector<qint64> viewportTimes;
+    // Zooms never fully covered, before the next one or the time out.
+    int incompleteViewports;
+
+    int tilesRendered;
+    int tilesWasted;
+    qint64 texturePeak;
+};
+
+struct BenchmarkSettings
+{
+    BenchmarkSettings();
+
+    QString trajectoryFile;
+    QString saveFile;
+    QString compareFile;
+    // A metric worse by more than this percentage is a regression.
+    qreal threshold;
+};
+
+// Prints the result, compared with a baseline if any, and returns the
+// number of regressions, or -1 if the baseline can not be read.
+int reportBenchmark(const BenchmarkResult &result, const BenchmarkSettings &settings);
+
+#endif
@@ -0,0 +1,548 @@
+/*
+    This file is part of the Ofi Labs X2 project.
+
+    Copyright (C) 2011 Ariya Hidayat <ariya.hidayat@gmail.com>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of
+    the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "tilecache.h"
+
+#include <QCryptographicHash>
+#include <QDir>
+#if QT_VERSION >= 0x050000
+#include <QStandardPaths>
+#else
+#include <QDesktopServices>
+#endif
+#include <QPair>
+#include <QtAlgorithms>
+
+#include <string.h>
+
+// Bump whenever tiles are rendered differently.
+const quint32 CacheVersion = 2;
+
+const quint32 PackMagic = 0x58325443; // X2TC
+const quint32 RecordMagic = 0x54494c45; // TILE
+
+// Compaction keeps that fraction of the budget, to not start over soon.
+const qreal CompactionRatio = 0.75;
+
+// Invalidations remembered to check stored tiles against. A tile rendered
+// before the oldest of them is refused without looking.
+const int MaxInvalidations = 64;
+
+// Everything is stored in the host byte order: the cache never leaves the
+// machine.
+struct PackHeader
+{
+    quint32 magic;
+    quint32 version;
+    quint32 tileDim;
+    quint32 reserved;
+};
+
+struct RecordHeader
+{
+    quint32 magic;
+    quint32 size;
+    TileCacheKey key;
+};
+
+bool operator==(const TileCacheKey &key1, const TileCacheKey &key2)
+{
+    return key1.document == key2.document && key1.zoomFactor == key2.zoomFactor
+        && key1.x == key2.x && key1.y == key2.y;
+}
+
+uint qHash(const TileCacheKey &key)
+{
+    return qHash(key.document ^ key.zoomFactor) ^ uint(key.x * 8191 + key.y);
+}
+
+// Appends a record at the end of the file. A partial record is cut, the
+// pack stays readable.
+static bool appendRecord(QFile &file, const RecordHeader &header, const char *data)
+{
+    qint64 offset = file.size();
+    bool written = file.seek(offset)
+        && file.write(reinterpret_cast<const char*>(&header), sizeof(header)) == qint64(sizeof(header))
+        && file.write(data, header.size) == qint64(header.size);
+    if (!written)
+        file.resize(offset);
+    return written;
+}
+
+TileCache::TileCache(const QString &fileName, const QByteArray &document, int tileDim, qint64 budget)
+    : m_fileName(fileName)
+    , m_document(0)
+    , m_tileDim(tileDim)
+    , m_budget(budget)
+    , m_map(0)
+    , m_mapSize(0)
+    , m_compacting(false)
+    , m_generation(0)
+    , m_clock(0)
+    , m_hitCount(0)
+    , m_missCount(0)
+{
+    QByteArray digest = QCryptographicHash::hash(document, QCryptographicHash::Md5);
+    memcpy(&m_document, digest.constData(), sizeof(m_document));
+
+    if (!open())
+        qWarning("Tile cache: can not use %s", qPrintable(m_fileName));
+}
+
+TileCache::~TileCache()
+{
+    if (m_map)
+        m_file.unmap(m_map);
+}
+
+QString TileCache::defaultFileName()
+{
+#if QT_VERSION >= 0x050000
+    QString location = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+#else
+    QString location = QDesktopServices::storageLocation(QDesktopServices::CacheLocation);
+#endif
+    if (location.isEmpty())
+        location = QDir::tempPath();
+    QDir().mkpath(location);
+    return QDir(location).filePath("backingstore-tiles.pack");
+}
+
+// Only the compressed bytes are copied under the lock, decompressing
+// happens concurrently.
+bool TileCache::load(qreal zoomFactor, int x, int y, QImage *tile)
+{
+    QByteArray data;
+    {
+        QMutexLocker locker(&m_mutex);
+        QHash<TileCacheKey, Entry>::iterator it = m_entries.find(key(zoomFactor, x, y));
+        if (it == m_entries.end() || !m_file.isOpen()) {
+            ++m_missCount;
+            return false;
+        }
+        Entry &entry = it.value();
+        if (entry.offset + entry.size > m_mapSize && !map()) {
+            ++m_missCount;
+            return false;
+        }
+        data = QByteArray(reinterpret_cast<const char*>(m_map + entry.offset), entry.size);
+        entry.stamp = ++m_clock;
+    }
+
+    QByteArray pixels = qUncompress(data);
+    int bytesPerLine = m_tileDim * 4;
+    if (pixels.size() != bytesPerLine * m_tileDim) {
+        QMutexLocker locker(&m_mutex);
+        m_entries.remove(key(zoomFactor, x, y));
+        ++m_missCount;
+        return false;
+    }
+
+    QImage image(m_tileDim, m_tileDim, QImage::Format_ARGB32);
+    for (int row = 0; row < m_tileDim; ++row)
+        memcpy(image.scanLine(row), pixels.constData() + row * bytesPerLine, bytesPerLine);
+    *tile = image;
+
+    QMutexLocker locker(&m_mutex);
+    ++m_hitCount;
+    return true;
+}
+
+void TileCache::store(qreal zoomFactor, int x, int y, const QImage &tile, uint generation)
+{
+    if (tile.width() != m_tileDim || tile.height() != m_tileDim)
+        return;
+
+    QImage image = tile.convertToFormat(QImage::Format_ARGB32);
+    int bytesPerLine = m_tileDim * 4;
+    QByteArray pixels(bytesPerLine * m_tileDim, 0);
+    for (int row = 0; row < m_tileDim; ++row)
+        memcpy(pixels.data() + row * bytesPerLine, image.constScanLine(row), bytesPerLine);
+    QByteArray data = qCompress(pixels);
+
+    QMutexLocker locker(&m_mutex);
+    TileCacheKey tileKey = key(zoomFactor, x, y);
+    if (!m_file.isOpen() || m_entries.contains(tileKey) || isInvalidated(zoomFactor, x, y, generation))
+        return;
+
+    RecordHeader header;
+    header.magic = RecordMagic;
+    header.size = data.size();
+    header.key = tileKey;
+
+    if (!appendRecord(m_file, header, data.constData())) {
+        qWarning("Tile cache: can not write to %s", qPrintable(m_fileName));
+        return;
+    }
+    m_file.flush();
+
+    Entry entry;
+    entry.offset = m_file.size() - data.size();
+    entry.size = data.size();
+    entry.stamp = ++m_clock;
+    m_entries.insert(tileKey, entry);
+
+    // Compaction takes the lock on its own, only when needed.
+    bool full = m_file.size() > m_budget && !m_compacting;
+    locker.unlock();
+    if (full)
+        compact();
+}
+
+void TileCache::invalidate(const QRectF &area)
+{
+    QMutexLocker locker(&m_mutex);
+    m_invalidations += qMakePair(++m_generation, area);
+    if (m_invalidations.count() > MaxInvalidations)
+        m_invalidations.removeFirst();
+    if (!m_file.isOpen())
+        return;
+
+    QList<TileCacheKey> removed;
+    QHash<TileCacheKey, Entry>::const_iterator it;
+    for (it = m_entries.constBegin(); it != m_entries.constEnd(); ++it) {
+        const TileCacheKey &tileKey = it.key();
+        double zoom;
+        memcpy(&zoom, &tileKey.zoomFactor, sizeof(zoom));
+        if (tileArea(zoom, tileKey.x, tileKey.y).intersects(area))
+            removed += tileKey;
+    }
+    foreach (const TileCacheKey &tileKey, removed)
+        writeRemoval(tileKey);
+    m_file.flush();
+}
+
+void TileCache::remove(qreal zoomFactor, int x, int y)
+{
+    QMutexLocker locker(&m_mutex);
+    TileCacheKey tileKey = key(zoomFactor, x, y);
+    if (!m_file.isOpen() || !m_entries.contains(tileKey))
+        return;
+    writeRemoval(tileKey);
+    m_file.flush();
+}
+
+uint TileCache::generation() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_generation;
+}
+
+qint64 TileCache::size() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_file.size();
+}
+
+int TileCache::tileCount() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_entries.count();
+}
+
+int TileCache::hitCount() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_hitCount;
+}
+
+int TileCache::missCount() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_missCount;
+}
+
+// The zoom factor is keyed by its exact bits.
+TileCacheKey TileCache::key(qreal zoomFactor, int x, int y) const
+{
+    TileCacheKey key;
+    key.document = m_document;
+    double zoom = zoomFactor;
+    memcpy(&key.zoomFactor, &zoom, sizeof(key.zoomFactor));
+    key.x = x;
+    key.y = y;
+    return key;
+}
+
+// What the tile covers in the document, with the extra pixel drawn for
+// the antialiased edges.
+QRectF TileCache::tileArea(double zoomFactor, int x, int y) const
+{
+    qreal pixel = 1 / zoomFactor;
+    qreal extent = m_tileDim / zoomFactor;
+    QRectF tile(x * extent, y * extent, extent, extent);
+    return tile.adjusted(-pixel, -pixel, pixel, pixel);
+}
+
+// Whether an invalidation after that generation covers the tile.
+bool TileCache::isInvalidated(qreal zoomFactor, int x, int y, uint generation) const
+{
+    if (generation == m_generation)
+        return false;
+    if (m_invalidations.isEmpty() || m_invalidations.first().first > generation + 1)
+        return true;
+    QRectF area = tileArea(zoomFactor, x, y);
+    for (int i = m_invalidations.count() - 1; i >= 0 && m_invalidations.at(i).first > generation; --i)
+        if (m_invalidations.at(i).second.intersects(area))
+            return true;
+    return false;
+}
+
+void TileCache::writeRemoval(const TileCacheKey &tileKey)
+{
+    RecordHeader header;
+    header.magic = RecordMagic;
+    header.size = 0;
+    header.key = tileKey;
+    if (!appendRecord(m_file, header, 0))
+        qWarning("Tile cache: can not write to %s, a removed tile may come back", qPrintable(m_fileName));
+    m_entries.remove(tileKey);
+}
+
+// Reads the index of the pack, starting over if it is from another
+// version or damaged. A truncated last record (e.g. after a crash) is cut.
+bool TileCache::open()
+{
+    m_file.setFileName(m_fileName);
+    if (!m_file.open(QIODevice::ReadWrite))
+        return false;
+
+    PackHeader pack;
+    bool valid = m_file.read(reinterpret_cast<char*>(&pack), sizeof(pack)) == sizeof(pack)
+        && pack.magic == PackMagic && pack.version == CacheVersion
+        && int(pack.tileDim) == m_tileDim;
+    if (!valid) {
+        pack.magic = PackMagic;
+        pack.version = CacheVersion;
+        pack.tileDim = m_tileDim;
+        pack.reserved = 0;
+        m_file.resize(0);
+        m_file.seek(0);
+        m_file.write(reinterpret_cast<const char*>(&pack), sizeof(pack));
+        m_file.flush();
+    }
+
+    m_entries.clear();
+    qint64 offset = sizeof(pack);
+    qint64 fileSize = m_file.size();
+    while (offset + qint64(sizeof(RecordHeader)) <= fileSize) {
+        RecordHeader header;
+        m_file.seek(offset);
+        if (m_file.read(reinterpret_cast<char*>(&header), sizeof(header)) != sizeof(header))
+            break;
+        if (header.magic != RecordMagic)
+            break;
+        qint64 end = offset + sizeof(header) + header.size;
+        if (end > fileSize)
+            break;
+
+        // An empty record removes the tile.
+        if (header.size == 0) {
+            m_entries.remove(header.key);
+            offset = end;
+            continue;
+        }
+
+        // Stamps follow the order in the pack: the last written is the
+        // most recent.
+        Entry entry;
+        entry.offset = offset + sizeof(header);
+        entry.size = header.size;
+        entry.stamp = ++m_clock;
+        m_entries.insert(header.key, entry);
+        offset = end;
+    }
+    if (offset < fileSize)
+        m_file.resize(offset);
+
+    if (m_file.size() > m_budget)
+        compact();
+    return map();
+}
+
+bool TileCache::map()
+{
+    if (m_map)
+        m_file.unmap(m_map);
+    m_mapSize = m_file.size();
+    m_map = m_file.map(0, m_mapSize);
+    if (!m_map)
+        m_mapSize = 0;
+    return m_map != 0;
+}
+
+static bool newerEntry(const QPair<uint, TileCacheKey> &entry1, const QPair<uint, TileCacheKey> &entry2)
+{
+    return entry1.first > entry2.first;
+}
+
+// Writes the tiles, oldest first, to a new pack: the stamps are rebuilt in
+// that order on open. The records are read through a handle of its own,
+// the mapping of the current pack may change meanwhile.
+bool TileCache::writePack(const QString &fileName, const QList<QPair<TileCacheKey, Entry> > &tiles,
+                          QHash<TileCacheKey, Entry> *entries) const
+{
+    QFile source(m_fileName);
+    QFile packed(fileName);
+    if (!source.open(QIODevice::ReadOnly) || !packed.open(QIODevice::ReadWrite | QIODevice::Truncate))
+        return false;
+
+    PackHeader pack;
+    pack.magic = PackMagic;
+    pack.version = CacheVersion;
+    pack.tileDim = m_tileDim;
+    pack.reserved = 0;
+    if (packed.write(reinterpret_cast<const char*>(&pack), sizeof(pack)) != qint64(sizeof(pack)))
+        return false;
+
+    for (int i = 0; i < tiles.count(); ++i) {
+        const TileCacheKey &tileKey = tiles.at(i).first;
+        Entry entry = tiles.at(i).second;
+        if (!source.seek(entry.offset))
+            return false;
+        QByteArray data = source.read(entry.size);
+        if (data.size() != entry.size)
+            return false;
+
+        RecordHeader header;
+        header.magic = RecordMagic;
+        header.size = entry.size;
+        header.key = tileKey;
+        if (!appendRecord(packed, header, data.constData()))
+            return false;
+        entry.offset = packed.size() - entry.size;
+        entries->insert(tileKey, entry);
+    }
+    return packed.flush();
+}
+
+// Writes the most recently used tiles to a new pack, which then replaces
+// the current one. Only picking the tiles and swapping the packs happen
+// under the lock, not the copy: loads, removals and other stores go on
+// meanwhile, and whatever changed is carried over before the swap. On any
+// failure, the current pack stays.
+void TileCache::compact()
+{
+    QList<QPair<TileCacheKey, Entry> > kept;
+    qint64 snapshotEnd;
+    {
+        QMutexLocker locker(&m_mutex);
+        if (m_compacting || !m_file.isOpen())
+            return;
+        m_compacting = true;
+        m_file.flush();
+        snapshotEnd = m_file.size();
+
+        QList<QPair<uint, TileCacheKey> > recent;
+        QHash<TileCacheKey, Entry>::const_iterator it;
+        for (it = m_entries.constBegin(); it != m_entries.constEnd(); ++it)
+            recent += qMakePair(it.value().stamp, it.key());
+        qSort(recent.begin(), recent.end(), newerEntry);
+
+        qint64 target = m_budget * CompactionRatio;
+        qint64 total = sizeof(PackHeader);
+        int count = 0;
+        while (count < recent.count()) {
+            const Entry &entry = m_entries[recent.at(count).second];
+            if (total + qint64(sizeof(RecordHeader)) + entry.size > target)
+                break;
+            total += sizeof(RecordHeader) + entry.size;
+            ++count;
+        }
+        for (int i = count - 1; i >= 0; --i)
+            kept += qMakePair(recent.at(i).second, m_entries.value(recent.at(i).second));
+    }
+
+    QString packedName = m_fileName + ".new";
+    QHash<TileCacheKey, Entry> entries;
+    bool written = writePack(packedName, kept, &entries);
+
+    QMutexLocker locker(&m_mutex);
+    m_compacting = false;
+
+    // Tiles stored since the snapshot are copied, tiles removed since are
+    // removed from the new pack too.
+    QFile packed(packedName);
+    written = written && packed.open(QIODevice::ReadWrite);
+    QHash<TileCacheKey, Entry>::const_iterator it;
+    for (it = m_entries.constBegin(); written && it != m_entries.constEnd(); ++it) {
+        if (it.value().offset < snapshotEnd)
+            continue;
+        Entry entry = it.value();
+        m_file.seek(entry.offset);
+        QByteArray data = m_file.read(entry.size);
+        RecordHeader header;
+        header.magic = RecordMagic;
+        header.size = entry.size;
+        header.key = it.key();
+        written = data.size() == entry.size && appendRecord(packed, header, data.constData());
+        entry.offset = packed.size() - entry.size;
+        entries.insert(it.key(), entry);
+    }
+    for (int i = 0; written && i < kept.count(); ++i) {
+        const TileCacheKey &tileKey = kept.at(i).first;
+        if (m_entries.contains(tileKey)) {
+            entries[tileKey].stamp = m_entries.value(tileKey).stamp;
+            continue;
+        }
+        RecordHeader header;
+        header.magic = RecordMagic;
+        header.size = 0;
+        header.key = tileKey;
+        written = appendRecord(packed, header, 0);
+        entries.remove(tileKey);
+    }
+    written = written && packed.flush();
+    packed.close();
+    if (!written) {
+        QFile::remove(packedName);
+        qWarning("Tile cache: can not compact %s", qPrintable(m_fileName));
+        return;
+    }
+
+    // The current pack is moved aside first, to be put back if the new
+    // one can not take its place.
+    if (m_map)
+        m_file.unmap(m_map);
+    m_map = 0;
+    m_mapSize = 0;
+    m_file.close();
+
+    QString previousName = m_fileName + ".old";
+    QFile::remove(previousName);
+    bool swapped = QFile::rename(m_fileName, previousName);
+    if (swapped && !QFile::rename(packedName, m_fileName)) {
+        QFile::rename(previousName, m_fileName);
+        swapped = false;
+    }
+    if (swapped) {
+        QFile::remove(previousName);
+        m_entries = entries;
+    } else {
+        QFile::remove(packedName);
+        qWarning("Tile cache: can not replace %s", qPrintable(m_fileName));
+    }
+
+    m_file.setFileName(m_fileName);
+    if (!m_file.open(QIODevice::ReadWrite)) {
+        m_entries.clear();
+        return;
+    }
+    map();
+}
@@ -0,0 +1,119 @@
+/*
+    This file is part of the Ofi Labs X2 project.
+
+    Copyright (C) 2011 Ariya Hidayat <ariya.hidayat@gmail.com>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of
+    the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef OFILABS_TILECACHE
+#define OFILABS_TILECACHE
+
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QImage>
+#include <QList>
+#include <QMutex>
+#include <QPair>
+#include <QRectF>
+#include <QString>
+
+struct TileCacheKey
+{
+    quint64 document;
+    quint64 zoomFactor;
+    qint32 x;
+    qint32 y;
+};
+
+bool operator==(const TileCacheKey &key1, const TileCacheKey &key2);
+uint qHash(const TileCacheKey &key);
+
+// Rendered tiles kept on disk across launches, compressed, in a single pack
+// file which is memory-mapped for reading. Tiles are keyed by the document
+// (a hash of its content), the zoom factor and the position in the grid.
+//
+// The pack starts with a version stamp, bumped whenever tiles would be
+// rendered differently. A pack with another stamp is thrown away, as is
+// any tile failing to decompress to the expected size.
+//
+// Once the pack grows beyond its budget, it is rewritten with only the
+// most recently used tiles, by the thread which stored the last one. The
+// other threads only wait for the new pack to be swapped in. Every
+// function is thread-safe.
+class TileCache
+{
+public:
+    TileCache(const QString &fileName, const QByteArray &document, int tileDim, qint64 budget);
+    ~TileCache();
+
+    static QString defaultFileName();
+
+    bool load(qreal zoomFactor, int x, int y, QImage *tile);
+
+    // The tile was rendered from the content as of generation(). It is
+    // refused if an invalidation since then covers it, as the cache would
+    // otherwise get back what invalidate() just removed.
+    void store(qreal zoomFactor, int x, int y, const QImage &tile, uint generation);
+
+    // Drops the tiles of every zoom factor covering the area, in document
+    // units, for good: an empty record in the pack marks them removed.
+    // Every call starts a new generation.
+    void invalidate(const QRectF &area);
+    void remove(qreal zoomFactor, int x, int y);
+    uint generation() const;
+
+    qint64 size() const;
+    int tileCount() const;
+    int hitCount() const;
+    int missCount() const;
+
+private:
+    struct Entry {
+        qint64 offset;
+        int size;
+        uint stamp;
+    };
+
+    TileCacheKey key(qreal zoomFactor, int x, int y) const;
+    QRectF tileArea(double zoomFactor, int x, int y) const;
+    bool isInvalidated(qreal zoomFactor, int x, int y, uint generation) const;
+    void writeRemoval(const TileCacheKey &tileKey);
+    bool open();
+    bool map();
+    void compact();
+    bool writePack(const QString &fileName, const QList<QPair<TileCacheKey, Entry> > &tiles,
+                   QHash<TileCacheKey, Entry> *entries) const;
+
+    QString m_fileName;
+    quint64 m_document;
+    int m_tileDim;
+    qint64 m_budget;
+
+    mutable QMutex m_mutex;
+    QFile m_file;
+    uchar *m_map;
+    qint64 m_mapSize;
+    bool m_compacting;
+    QHash<TileCacheKey, Entry> m_entries;
+    // The most recent invalidations, with the generation each started.
+    uint m_generation;
+    QList<QPair<uint, QRectF> > m_invalidations;
+    uint m_clock;
+    int m_hitCount;
+    int m_missCount;
+};
+
+#endif
@@ -0,0 +1,169 @@
+/*
+    This file is part of the Ofi Labs X2 project.
+
+    Copyright (C) 2011 Ariya Hidayat <ariya.hidayat@gmail.com>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of
+    the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "tileprefetcher.h"
+
+#include <qmath.h>
+
+// How far ahead, in milliseconds, the motion is extrapolated.
+const int LookAhead = 400;
+
+// Velocity is forgotten after the mouse stops for that long.
+const int VelocityTimeout = 150;
+
+// Weight of the newest sample in the (exponentially) smoothed velocity.
+const qreal Smoothing = 0.4;
+
+// Never prefetch more than these tiles ahead, whatever the speed.
+const int MaxLeadTiles = 8;
+
+TilePrefetcher::TilePrefetcher(int margin)
+    : m_margin(margin)
+    , m_lastSample(0)
+    , m_velocity(0, 0)
+    , m_prefetchCount(0)
+    , m_hitCount(0)
+    , m_wastedCount(0)
+    , m_cancelledCount(0)
+{
+    m_clock.start();
+}
+
+void TilePrefetcher::startPan()
+{
+    m_velocity = QPointF(0, 0);
+    m_lastSample = m_clock.elapsed();
+}
+
+void TilePrefetcher::addPanSample(const QPointF &delta)
+{
+    qint64 now = m_clock.elapsed();
+    qint64 interval = qMax(now - m_lastSample, qint64(1));
+    m_lastSample = now;
+
+    // A long pause means a new motion, do not average with the old one.
+    if (interval > VelocityTimeout) {
+        m_velocity = QPointF(0, 0);
+        return;
+    }
+    m_velocity = m_velocity * (1 - Smoothing) + delta / interval * Smoothing;
+}
+
+QPointF TilePrefetcher::velocity() const
+{
+    qint64 idle = m_clock.elapsed() - m_lastSample;
+    if (idle >= VelocityTimeout)
+        return QPointF(0, 0);
+    return m_velocity * (1 - qreal(idle) / VelocityTimeout);
+}
+
+// The content follows the mouse, i.e. moving the mouse to the left reveals
+// the tiles on the right. Behind the motion only one tile is kept.
+QRect TilePrefetcher::predictedRange(const QRect &visibleRange, qreal tileSize) const
+{
+    QPointF motion = -velocity() * LookAhead / tileSize;
+    int left = m_margin;
+    int right = m_margin;
+    int top = m_margin;
+    int bottom = m_margin;
+
+    int leadX = qMin(MaxLeadTiles, qCeil(qAbs(motion.x())));
+    if (motion.x() > 0.5) {
+        right = qMax(right, leadX);
+        left = qMin(left, 1);
+    } else if (motion.x() < -0.5) {
+        left = qMax(left, leadX);
+        right = qMin(right, 1);
+    }
+
+    int leadY = qMin(MaxLeadTiles, qCeil(qAbs(motion.y())));
+    if (motion.y() > 0.5) {
+        bottom = qMax(bottom, leadY);
+        top = qMin(top, 1);
+    } else if (motion.y() < -0.5) {
+        top = qMax(top, leadY);
+        bottom = qMin(bottom, 1);
+    }
+
+    return visibleRange.adjusted(-left, -top, right, bottom);
+}
+
+void TilePrefetcher::reset()
+{
+    m_wastedCount += m_prefetched.count();
+    m_prefetched.clear();
+}
+
+void TilePrefetcher::tileRendered(int index, bool visible)
+{
+    if (visible)
+        return;
+    m_prefetched += index;
+    ++m_prefetchCount;
+}
+
+void TilePrefetcher::tileShown(int index)
+{
+    if (m_prefetched.remove(index))
+        ++m_hitCount;
+}
+
+void TilePrefetcher::tileEvicted(int index)
+{
+    if (m_prefetched.remove(index))
+        ++m_wastedCount;
+}
+
+// Rendered for an outdated zoom level, never shown.
+void TilePrefetcher::tileDiscarded()
+{
+    ++m_wastedCount;
+}
+
+void TilePrefetcher::tilesCancelled(int count)
+{
+    m_cancelledCount += count;
+}
+
+int TilePrefetcher::prefetchCount() const
+{
+    return m_prefetchCount;
+}
+
+int TilePrefetcher::hitCount() const
+{
+    return m_hitCount;
+}
+
+int TilePrefetcher::wastedCount() const
+{
+    return m_wastedCount;
+}
+
+int TilePrefetcher::cancelledCount() const
+{
+    return m_cancelledCount;
+}
+
+qreal TilePrefetcher::hitRate() const
+{
+    if (m_prefetchCount == 0)
+        return 0;
+    return qreal(m_hitCount) / m_prefetchCount;
+}
@@ -0,0 +1,79 @@
+/*
+    This file is part of the Ofi Labs X2 project.
+
+    Copyright (C) 2011 Ariya Hidayat <ariya.hidayat@gmail.com>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of
+    the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef OFILABS_TILEPREFETCHER
+#define OFILABS_TILEPREFETCHER
+
+#include <QElapsedTimer>
+#include <QPointF>
+#include <QRect>
+#include <QSet>
+
+// Predicts which tiles will be needed while panning. The pan velocity is
+// tracked from the mouse moves, and the update range is extended along
+// the motion: far ahead of it, barely behind it. When the view stands
+// still, the range has the same margin in every direction.
+//
+// It also keeps score: a prefetched tile (rendered while outside the
+// visible range) is a hit once it becomes visible, and a wasted render if
+// it is thrown away before that. So is any tile arriving for an outdated
+// zoom level.
+class TilePrefetcher
+{
+public:
+    TilePrefetcher(int margin);
+
+    // Mouse-driven panning, the delta is in pixels.
+    void startPan();
+    void addPanSample(const QPointF &delta);
+
+    // Pixels per millisecond, decaying once the mouse stops.
+    QPointF velocity() const;
+
+    // The visible range of tiles, extended with the predicted motion.
+    QRect predictedRange(const QRect &visibleRange, qreal tileSize) const;
+
+    // The grid has been replaced: unseen prefetched tiles are lost.
+    void reset();
+    void tileRendered(int index, bool visible);
+    void tileShown(int index);
+    void tileEvicted(int index);
+    void tileDiscarded();
+    void tilesCancelled(int count);
+
+    int prefetchCount() const;
+    int hitCount() const;
+    int wastedCount() const;
+    int cancelledCount() const;
+    qreal hitRate() const;
+
+private:
+    int m_margin;
+    QElapsedTimer m_clock;
+    qint64 m_lastSample;
+    QPointF m_velocity;
+
+    QSet<int> m_prefetched;
+    int m_prefetchCount;
+    int m_hitCount;
+    int m_wastedCount;
+    int m_cancelledCount;
+};
+
+#endif
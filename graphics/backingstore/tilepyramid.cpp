@@ -0,0 +1,284 @@
+/*
+    This file is part of the Ofi Labs X2 project.
+
+    Copyright (C) 2011 Ariya Hidayat <ariya.hidayat@gmail.com>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of
+    the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "tilepyramid.h"
+
+#include <qmath.h>
+#include <QPair>
+#include <QtAlgorithms>
+
+const int TileBytes = TileDim * TileDim * 4;
+
+// Once over budget, evict down to this fraction of it. Eviction sorts all
+// the resident tiles, better not do it after every single upload.
+const qreal LowWaterMark = 0.875;
+
+TilePyramid::TilePyramid(qint64 budget)
+    : m_budget(budget)
+    , m_textureCount(0)
+    , m_peakMemoryUsage(0)
+    , m_frame(1)
+    , m_current(0)
+{
+}
+
+TilePyramid::~TilePyramid()
+{
+    qDeleteAll(m_levels);
+}
+
+qint64 TilePyramid::budget() const
+{
+    return m_budget;
+}
+
+void TilePyramid::setBudget(qint64 budget)
+{
+    m_budget = budget;
+}
+
+int TilePyramid::textureCount() const
+{
+    return m_textureCount;
+}
+
+qint64 TilePyramid::memoryUsage() const
+{
+    return m_atlas.memoryUsage();
+}
+
+qint64 TilePyramid::peakMemoryUsage() const
+{
+    return m_peakMemoryUsage;
+}
+
+TextureBuffer *TilePyramid::setCurrentLevel(qreal zoomFactor, int w, int h)
+{
+    m_current = 0;
+    foreach (Level *level, m_levels) {
+        // Zooming in and out with the wheel hardly comes back to the very
+        // same factor, close enough is the same level.
+        if (qFuzzyCompare(level->buffer.zoomFactor, zoomFactor) && level->buffer.width() == w
+                && level->buffer.height() == h) {
+            level->buffer.zoomFactor = zoomFactor;
+            m_current = level;
+            break;
+        }
+    }
+
+    if (!m_current) {
+        m_current = new Level(&m_atlas);
+        m_current->buffer.zoomFactor = zoomFactor;
+        m_current->buffer.resize(w, h);
+        m_current->stamps.resize(w * h);
+        m_current->stamps.fill(0);
+        m_current->outdated.fill(false, w * h);
+        m_levels += m_current;
+    }
+
+    removeEmptyLevels();
+    return &m_current->buffer;
+}
+
+TextureBuffer *TilePyramid::currentLevel() const
+{
+    return m_current ? &m_current->buffer : 0;
+}
+
+static bool fartherLevel(const QPair<qreal, const TextureBuffer*> &level1,
+                         const QPair<qreal, const TextureBuffer*> &level2)
+{
+    return level1.first > level2.first;
+}
+
+// Zoom factors are compared by ratio, 1x is as far from 2x as from 0.5x.
+QList<const TextureBuffer*> TilePyramid::levels(qreal zoomFactor) const
+{
+    QList<QPair<qreal, const TextureBuffer*> > sorted;
+    foreach (Level *level, m_levels) {
+        qreal distance = qAbs(qLn(level->buffer.zoomFactor / zoomFactor));
+        sorted += qMakePair(distance, static_cast<const TextureBuffer*>(&level->buffer));
+    }
+    qStableSort(sorted.begin(), sorted.end(), fartherLevel);
+
+    QList<const TextureBuffer*> result;
+    for (int i = 0; i < sorted.count(); ++i)
+        result += sorted.at(i).second;
+    return result;
+}
+
+void TilePyramid::insert(int x, int y, const QImage &tile)
+{
+    if (!m_current || x < 0 || y < 0)
+        return;
+    TextureBuffer &buffer = m_current->buffer;
+    if (x >= buffer.width() || y >= buffer.height())
+        return;
+
+    int index = y * buffer.width() + x;
+    remove(m_current, index);
+    int slot = m_atlas.allocate();
+    m_atlas.upload(slot, tile);
+    buffer.replace(x, y, slot);
+    m_current->stamps[index] = m_frame;
+    m_current->outdated[index] = false;
+    ++m_current->textureCount;
+    ++m_textureCount;
+    m_peakMemoryUsage = qMax(m_peakMemoryUsage, memoryUsage());
+}
+
+void TilePyramid::invalidate(const QRectF &area)
+{
+    foreach (Level *level, m_levels) {
+        const TextureBuffer &buffer = level->buffer;
+        QRect range = buffer.tileRange(area);
+        for (int y = range.top(); y <= range.bottom(); ++y)
+            for (int x = range.left(); x <= range.right(); ++x)
+                if (buffer.at(x, y) != 0)
+                    level->outdated[y * buffer.width() + x] = true;
+    }
+}
+
+bool TilePyramid::isOutdated(int x, int y) const
+{
+    if (!m_current || x < 0 || y < 0)
+        return false;
+    const TextureBuffer &buffer = m_current->buffer;
+    if (x >= buffer.width() || y >= buffer.height())
+        return false;
+    return m_current->outdated.at(y * buffer.width() + x);
+}
+
+void TilePyramid::touch(const TextureBuffer *buffer, const QRect &range)
+{
+    Level *owner = level(buffer);
+    if (!owner)
+        return;
+    QRect clipped = range & QRect(0, 0, buffer->width(), buffer->height());
+    for (int y = clipped.top(); y <= clipped.bottom(); ++y)
+        for (int x = clipped.left(); x <= clipped.right(); ++x)
+            owner->stamps[y * buffer->width() + x] = m_frame;
+}
+
+void TilePyramid::nextFrame()
+{
+    ++m_frame;
+}
+
+struct EvictionCandidate
+{
+    uint stamp;
+    int level;
+    int index;
+};
+
+static bool olderCandidate(const EvictionCandidate &candidate1, const EvictionCandidate &candidate2)
+{
+    return candidate1.stamp < candidate2.stamp;
+}
+
+// Tiles drawn in the current frame are never evicted, even if the budget
+// is too small for the view. The budget applies to the tiles: evicting
+// does not free a page until it is empty, a page-based count would evict
+// far more than needed.
+QList<QPoint> TilePyramid::trim()
+{
+    QList<QPoint> evicted;
+    if (qint64(m_textureCount) * TileBytes <= m_budget) {
+        m_atlas.releaseEmptyPages();
+        return evicted;
+    }
+
+    QVector<EvictionCandidate> candidates;
+    candidates.reserve(m_textureCount);
+    for (int i = 0; i < m_levels.count(); ++i) {
+        const Level *level = m_levels.at(i);
+        for (int index = 0; index < level->stamps.count(); ++index) {
+            const TextureBuffer &buffer = level->buffer;
+            if (buffer.at(index % buffer.width(), index / buffer.width()) == 0)
+                continue;
+            if (level->stamps.at(index) == m_frame)
+                continue;
+            EvictionCandidate candidate;
+            candidate.stamp = level->stamps.at(index);
+            candidate.level = i;
+            candidate.index = index;
+            candidates += candidate;
+        }
+    }
+    qSort(candidates.begin(), candidates.end(), olderCandidate);
+
+    qint64 target = m_budget * LowWaterMark;
+    for (int i = 0; i < candidates.count() && qint64(m_textureCount) * TileBytes > target; ++i) {
+        Level *level = m_levels.at(candidates.at(i).level);
+        int index = candidates.at(i).index;
+        remove(level, index);
+        if (level == m_current)
+            evicted += QPoint(index % level->buffer.width(), index / level->buffer.width());
+    }
+
+    removeEmptyLevels();
+    m_atlas.releaseEmptyPages();
+    return evicted;
+}
+
+void TilePyramid::clear()
+{
+    foreach (Level *level, m_levels) {
+        level->buffer.clear();
+        delete level;
+    }
+    m_levels.clear();
+    m_atlas.clear();
+    m_current = 0;
+    m_textureCount = 0;
+}
+
+TilePyramid::Level *TilePyramid::level(const TextureBuffer *buffer) const
+{
+    foreach (Level *level, m_levels)
+        if (&level->buffer == buffer)
+            return level;
+    return 0;
+}
+
+// Levels left without any tile are not worth keeping.
+void TilePyramid::removeEmptyLevels()
+{
+    for (int i = m_levels.count() - 1; i >= 0; --i) {
+        Level *level = m_levels.at(i);
+        if (level != m_current && level->textureCount == 0) {
+            m_levels.removeAt(i);
+            delete level;
+        }
+    }
+}
+
+void TilePyramid::remove(Level *level, int index)
+{
+    TextureBuffer &buffer = level->buffer;
+    int x = index % buffer.width();
+    int y = index / buffer.width();
+    if (buffer.at(x, y) == 0)
+        return;
+    buffer.remove(x, y);
+    level->outdated[index] = false;
+    --level->textureCount;
+    --m_textureCount;
+}
@@ -0,0 +1,107 @@
+/*
+    This file is part of the Ofi Labs X2 project.
+
+    Copyright (C) 2011 Ariya Hidayat <ariya.hidayat@gmail.com>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of
+    the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef OFILABS_TILEPYRAMID
+#define OFILABS_TILEPYRAMID
+
+#include <QList>
+#include <QPoint>
+#include <QRectF>
+#include <QVector>
+
+#include "textureatlas.h"
+#include "texturebuffer.h"
+
+// Texture buffers of every recently used zoom level. One of them is the
+// current level, for which tiles are being rendered. The other ones keep
+// their tiles as long as the texture memory budget allows, and serve as
+// placeholders while the current level is incomplete.
+//
+// Tiles are evicted least recently drawn first, regardless of their level.
+// All levels share the same texture atlas, whose pages are freed once
+// eviction leaves them empty. Levels left without any tile are dropped.
+class TilePyramid
+{
+public:
+    TilePyramid(qint64 budget);
+    ~TilePyramid();
+
+    // Texture memory allowed for the tiles, in bytes.
+    qint64 budget() const;
+    void setBudget(qint64 budget);
+
+    int textureCount() const;
+    // Texture memory of the atlas pages, in bytes. Pages being shared by
+    // many tiles, it is more than the tiles take until eviction empties
+    // some of them.
+    qint64 memoryUsage() const;
+    qint64 peakMemoryUsage() const;
+
+    // Switches to the level of that zoom factor, creating it if necessary
+    // with a w x h grid. Its resident tiles are kept, other levels without
+    // any tile are dropped.
+    TextureBuffer *setCurrentLevel(qreal zoomFactor, int w, int h);
+    TextureBuffer *currentLevel() const;
+
+    // Every level, the closest to the zoom factor last: drawing them in
+    // this order leaves the best one on top.
+    QList<const TextureBuffer*> levels(qreal zoomFactor) const;
+
+    // Uploads a tile of the current level. Its previous texture, if any,
+    // is freed.
+    void insert(int x, int y, const QImage &tile);
+
+    // Marks the resident tiles of every level covering the area (in
+    // document units) as outdated. They are still drawn until replaced.
+    void invalidate(const QRectF &area);
+    // Whether the tile of the current level is outdated.
+    bool isOutdated(int x, int y) const;
+
+    // Marks the tiles of the range as drawn in the current frame.
+    void touch(const TextureBuffer *buffer, const QRect &range);
+    void nextFrame();
+
+    // Evicts least recently drawn tiles until the budget is respected, and
+    // returns the ones evicted from the current level.
+    QList<QPoint> trim();
+
+    void clear();
+
+private:
+    struct Level {
+        Level(TextureAtlas *atlas) : buffer(atlas), textureCount(0) { }
+        TextureBuffer buffer;
+        QVector<uint> stamps;
+        QVector<bool> outdated;
+        int textureCount;
+    };
+    Level *level(const TextureBuffer *buffer) const;
+    void remove(Level *level, int index);
+    void removeEmptyLevels();
+
+    qint64 m_budget;
+    int m_textureCount;
+    qint64 m_peakMemoryUsage;
+    uint m_frame;
+    TextureAtlas m_atlas;
+    QList<Level*> m_levels;
+    Level *m_current;
+};
+
+#endif
@@ -0,0 +1,202 @@
+/*
+    This file is part of the Ofi Labs X2 project.
+
+    Copyright (C) 2011 Ariya Hidayat <ariya.hidayat@gmail.com>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of
+    the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "tilerenderer.h"
+#include "svgdisplaylist.h"
+#include "tilecache.h"
+
+#include <QCoreApplication>
+#include <QPainter>
+#include <QSvgRenderer>
+#include <QThread>
+
+class TileWorker: public QThread
+{
+public:
+    TileWorker(TileRenderer *renderer, SvgDisplayList *displayList)
+        : m_renderer(renderer), m_displayList(displayList) { }
+    ~TileWorker() { delete m_displayList; }
+
+protected:
+    void run();
+
+private:
+    TileRenderer *m_renderer;
+    SvgDisplayList *m_displayList;
+};
+
+void TileWorker::run()
+{
+    const SvgDisplayList *displayList = m_displayList;
+    int dim = m_renderer->m_tileDim;
+    TileCache *cache = m_renderer->m_cache;
+
+    TileRequest request;
+    while (m_renderer->waitForRequest(&request)) {
+        RenderedTile tile;
+        tile.zoomFactor = request.zoomFactor;
+        tile.x = request.x;
+        tile.y = request.y;
+
+        if (!cache || !cache->load(request.zoomFactor, request.x, request.y, &tile.image)) {
+            tile.image = QImage(dim, dim, QImage::Format_ARGB32);
+            tile.image.fill(qRgb(255, 255, 255));
+
+            // The area of the tile in the document, with an extra pixel
+            // for the antialiased edges.
+            qreal extent = dim / request.zoomFactor;
+            qreal pixel = 1 / request.zoomFactor;
+            QRectF area(request.x * extent, request.y * extent, extent, extent);
+
+            QPainter p(&tile.image);
+            p.setRenderHint(QPainter::Antialiasing, true);
+            p.translate(-request.x * dim, -request.y * dim);
+            p.scale(request.zoomFactor, request.zoomFactor);
+            displayList->draw(&p, area.adjusted(-pixel, -pixel, pixel, pixel));
+            p.end();
+
+            if (cache)
+                cache->store(request.zoomFactor, request.x, request.y, tile.image, request.generation);
+        }
+
+        m_renderer->finish(tile);
+    }
+}
+
+TileRenderer::TileRenderer(const QByteArray &document, int tileDim, QObject *receiver,
+                           TileCache *cache, int threadCount)
+    : m_tileDim(tileDim)
+    , m_receiver(receiver)
+    , m_cache(cache)
+    , m_active(0)
+    , m_notified(false)
+    , m_terminate(false)
+{
+    QSvgRenderer svg(document);
+    SvgDisplayList displayList(&svg);
+    m_documentSize = displayList.size();
+
+    // Every worker draws its own copy of the list, see SvgDisplayList.
+    if (threadCount <= 0)
+        threadCount = QThread::idealThreadCount();
+    for (int i = 0; i < qMax(threadCount, 1); ++i) {
+        TileWorker *worker = new TileWorker(this, displayList.clone());
+        m_workers += worker;
+        worker->start(QThread::LowPriority);
+    }
+}
+
+TileRenderer::~TileRenderer()
+{
+    m_mutex.lock();
+    m_terminate = true;
+    m_queue.clear();
+    m_condition.wakeAll();
+    m_mutex.unlock();
+
+    foreach (TileWorker *worker, m_workers) {
+        worker->wait();
+        delete worker;
+    }
+}
+
+QSize TileRenderer::documentSize() const
+{
+    return m_documentSize;
+}
+
+int TileRenderer::threadCount() const
+{
+    return m_workers.count();
+}
+
+void TileRenderer::request(const TileRequest &tile)
+{
+    m_mutex.lock();
+    m_queue += tile;
+    m_condition.wakeOne();
+    m_mutex.unlock();
+}
+
+void TileRenderer::clear()
+{
+    m_mutex.lock();
+    m_queue.clear();
+    m_mutex.unlock();
+}
+
+QList<TileRequest> TileRenderer::cancelOutside(const QRect &range)
+{
+    QList<TileRequest> cancelled;
+    m_mutex.lock();
+    for (int i = m_queue.count() - 1; i >= 0; --i) {
+        const TileRequest &tile = m_queue.at(i);
+        if (!range.contains(tile.x, tile.y))
+            cancelled += m_queue.takeAt(i);
+    }
+    m_mutex.unlock();
+    return cancelled;
+}
+
+int TileRenderer::pendingCount() const
+{
+    m_mutex.lock();
+    int count = m_queue.count() + m_active + m_rendered.count();
+    m_mutex.unlock();
+    return count;
+}
+
+QList<RenderedTile> TileRenderer::takeRenderedTiles()
+{
+    m_mutex.lock();
+    QList<RenderedTile> tiles = m_rendered;
+    m_rendered.clear();
+    m_notified = false;
+    m_mutex.unlock();
+    return tiles;
+}
+
+bool TileRenderer::waitForRequest(TileRequest *tile)
+{
+    m_mutex.lock();
+    while (m_queue.isEmpty() && !m_terminate)
+        m_condition.wait(&m_mutex);
+    bool terminate = m_terminate;
+    if (!terminate) {
+        *tile = m_queue.takeFirst();
+        ++m_active;
+    }
+    m_mutex.unlock();
+    return !terminate;
+}
+
+// Only one event is pending at any time, the receiver takes every tile
+// finished so far at once.
+void TileRenderer::finish(const RenderedTile &tile)
+{
+    m_mutex.lock();
+    --m_active;
+    m_rendered += tile;
+    bool notify = !m_notified;
+    m_notified = true;
+    m_mutex.unlock();
+
+    if (notify)
+        QCoreApplication::postEvent(m_receiver, new QEvent(TileRenderedEvent));
+}
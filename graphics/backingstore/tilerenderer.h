@@ -0,0 +1,110 @@
+/*
+    This file is part of the Ofi Labs X2 project.
+
+    Copyright (C) 2011 Ariya Hidayat <ariya.hidayat@gmail.com>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of
+    the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef OFILABS_TILERENDERER
+#define OFILABS_TILERENDERER
+
+#include <QByteArray>
+#include <QEvent>
+#include <QImage>
+#include <QList>
+#include <QMutex>
+#include <QRect>
+#include <QSize>
+#include <QWaitCondition>
+
+class QObject;
+class TileCache;
+class TileWorker;
+
+// A tile of the grid at a given zoom level. The generation is the one of
+// the tile cache when the request was made, see TileCache::store().
+struct TileRequest
+{
+    qreal zoomFactor;
+    int x;
+    int y;
+    uint generation;
+};
+
+struct RenderedTile
+{
+    qreal zoomFactor;
+    int x;
+    int y;
+    QImage image;
+};
+
+// Rasterizes tiles of an SVG document on a pool of worker threads. The
+// document is recorded once into a display list, and each worker draws
+// from its own copy of it: every tile only goes through the shapes
+// intersecting it.
+// Whenever tiles are finished, a TileRenderedEvent is posted to the
+// receiver, which then picks them up with takeRenderedTiles(). No call
+// ever waits for a tile being rendered.
+//
+// With a tile cache, workers look the tile up there first, and store what
+// they had to render unless the area was invalidated since the request.
+class TileRenderer
+{
+public:
+    static const QEvent::Type TileRenderedEvent = QEvent::Type(QEvent::User + 1);
+
+    TileRenderer(const QByteArray &document, int tileDim, QObject *receiver,
+                 TileCache *cache = 0, int threadCount = 0);
+    ~TileRenderer();
+
+    QSize documentSize() const;
+    int threadCount() const;
+
+    void request(const TileRequest &tile);
+
+    // Drops the requests which no worker has started yet.
+    void clear();
+
+    // Drops the requests not started yet for tiles outside the range,
+    // and returns them.
+    QList<TileRequest> cancelOutside(const QRect &range);
+
+    // Requests waiting or being rendered, not yet taken.
+    int pendingCount() const;
+
+    QList<RenderedTile> takeRenderedTiles();
+
+private:
+    friend class TileWorker;
+    bool waitForRequest(TileRequest *tile);
+    void finish(const RenderedTile &tile);
+
+    QSize m_documentSize;
+    int m_tileDim;
+    QObject *m_receiver;
+    TileCache *m_cache;
+    QList<TileWorker*> m_workers;
+
+    mutable QMutex m_mutex;
+    QWaitCondition m_condition;
+    QList<TileRequest> m_queue;
+    QList<RenderedTile> m_rendered;
+    int m_active;
+    bool m_notified;
+    bool m_terminate;
+};
+
+#endif
@@ -0,0 +1,184 @@
+/*
+    This file is part of the Ofi Labs X2 project.
+
+    Copyright (C) 2011 Ariya Hidayat <ariya.hidayat@gmail.com>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of
+    the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "tilescheduler.h"
+
+#include <algorithm>
+
+TileScheduler::TileScheduler()
+    : m_width(0)
+    , m_height(0)
+    , m_maxQueueDepth(0)
+    , m_pendingCount(0)
+    , m_rebuildCount(0)
+{
+}
+
+void TileScheduler::reset(int w, int h)
+{
+    m_width = w;
+    m_height = h;
+    m_states.resize(w * h);
+    m_states.fill(Dirty);
+    m_pendingCount = 0;
+    m_range = QRect();
+    m_heap.clear();
+}
+
+// Nothing moved, nothing to do. Otherwise every distance in the heap is
+// outdated: rebuilding costs only as much as the tiles of the range.
+void TileScheduler::setView(const QRect &range, const QPointF &center)
+{
+    QRect clipped = range & QRect(0, 0, m_width, m_height);
+    if (clipped == m_range && center == m_center)
+        return;
+    m_range = clipped;
+    m_center = center;
+    rebuild();
+}
+
+bool TileScheduler::takeNext(QPoint *tile)
+{
+    // Skip the tiles which got done while waiting in the heap.
+    int index;
+    do {
+        if (m_heap.isEmpty())
+            return false;
+        std::pop_heap(m_heap.begin(), m_heap.end(), fartherEntry);
+        index = m_heap.last().index;
+        m_heap.removeLast();
+    } while (m_states.at(index) != Dirty);
+
+    m_states[index] = Pending;
+    ++m_pendingCount;
+    *tile = QPoint(index % m_width, index / m_width);
+    return true;
+}
+
+bool TileScheduler::isPending(int x, int y) const
+{
+    if (x < 0 || y < 0 || x >= m_width || y >= m_height)
+        return false;
+    return m_states.at(y * m_width + x) == Pending;
+}
+
+void TileScheduler::markDone(int x, int y)
+{
+    if (x < 0 || y < 0 || x >= m_width || y >= m_height)
+        return;
+    int index = y * m_width + x;
+    if (m_states.at(index) == Pending || m_states.at(index) == Outdated)
+        --m_pendingCount;
+    m_states[index] = Done;
+}
+
+// A tile done while in the heap may leave an outdated entry, which
+// takeNext() skips.
+void TileScheduler::markDirty(int x, int y)
+{
+    if (x < 0 || y < 0 || x >= m_width || y >= m_height)
+        return;
+    int index = y * m_width + x;
+    State state = State(m_states.at(index));
+    if (state == Dirty)
+        return;
+    if (state == Pending || state == Outdated)
+        --m_pendingCount;
+    m_states[index] = Dirty;
+    if (m_range.contains(x, y))
+        push(x, y);
+}
+
+void TileScheduler::invalidate(int x, int y)
+{
+    if (x < 0 || y < 0 || x >= m_width || y >= m_height)
+        return;
+    int index = y * m_width + x;
+    if (m_states.at(index) == Pending)
+        m_states[index] = Outdated;
+    else if (m_states.at(index) == Done)
+        markDirty(x, y);
+}
+
+bool TileScheduler::isOutdated(int x, int y) const
+{
+    if (x < 0 || y < 0 || x >= m_width || y >= m_height)
+        return false;
+    return m_states.at(y * m_width + x) == Outdated;
+}
+
+int TileScheduler::queueDepth() const
+{
+    return m_heap.count();
+}
+
+int TileScheduler::maxQueueDepth() const
+{
+    return m_maxQueueDepth;
+}
+
+int TileScheduler::pendingCount() const
+{
+    return m_pendingCount;
+}
+
+int TileScheduler::rebuildCount() const
+{
+    return m_rebuildCount;
+}
+
+// The heap is a max-heap on this ordering, i.e. the closest tile is on top.
+bool TileScheduler::fartherEntry(const Entry &entry1, const Entry &entry2)
+{
+    return entry1.distance > entry2.distance;
+}
+
+qreal TileScheduler::distance(int x, int y) const
+{
+    return qAbs(x + 0.5 - m_center.x()) + qAbs(y + 0.5 - m_center.y());
+}
+
+void TileScheduler::push(int x, int y)
+{
+    Entry entry;
+    entry.distance = distance(x, y);
+    entry.index = y * m_width + x;
+    m_heap.append(entry);
+    std::push_heap(m_heap.begin(), m_heap.end(), fartherEntry);
+    m_maxQueueDepth = qMax(m_maxQueueDepth, m_heap.count());
+}
+
+void TileScheduler::rebuild()
+{
+    m_heap.clear();
+    for (int y = m_range.top(); y <= m_range.bottom(); ++y) {
+        for (int x = m_range.left(); x <= m_range.right(); ++x) {
+            int index = y * m_width + x;
+            if (m_states.at(index) != Dirty)
+                continue;
+            Entry entry;
+            entry.distance = distance(x, y);
+            entry.index = index;
+            m_heap.append(entry);
+        }
+    }
+    std::make_heap(m_heap.begin(), m_heap.end(), fartherEntry);
+    m_maxQueueDepth = qMax(m_maxQueueDepth, m_heap.count());
+    ++m_rebuildCount;
+}
@@ -0,0 +1,90 @@
+/*
+    This file is part of the Ofi Labs X2 project.
+
+    Copyright (C) 2011 Ariya Hidayat <ariya.hidayat@gmail.com>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of
+    the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef OFILABS_TILESCHEDULER
+#define OFILABS_TILESCHEDULER
+
+#include <QPoint>
+#include <QPointF>
+#include <QRect>
+#include <QVector>
+
+// Decides which tile of the grid to render next. Dirty tiles inside the
+// update range are kept in a binary heap keyed by their (Manhattan)
+// distance to the center of the view, thus the next tile is found in
+// O(log n) instead of scanning the whole grid. The heap only covers the
+// update range and is rebuilt when the view is panned or zoomed.
+class TileScheduler
+{
+public:
+    TileScheduler();
+
+    // Marks every tile of a w x h grid as dirty.
+    void reset(int w, int h);
+
+    // Range of tiles worth rendering, and the center of the view in
+    // tile units.
+    void setView(const QRect &range, const QPointF &center);
+
+    // Closest dirty tile, which is then marked as pending.
+    bool takeNext(QPoint *tile);
+
+    bool isPending(int x, int y) const;
+    // The tile has its texture, whether it was pending or not.
+    void markDone(int x, int y);
+    void markDirty(int x, int y);
+
+    // The content of the tile changed. A pending tile becomes outdated:
+    // it is not taken again until its stale rendering is back and marked
+    // dirty. Invalidating a tile not done yet changes nothing.
+    void invalidate(int x, int y);
+    bool isOutdated(int x, int y) const;
+
+    // Dirty tiles waiting in the heap, outdated entries included.
+    int queueDepth() const;
+    int maxQueueDepth() const;
+    // Tiles taken but not done yet, outdated ones included.
+    int pendingCount() const;
+    int rebuildCount() const;
+
+private:
+    enum State { Dirty, Pending, Outdated, Done };
+
+    struct Entry {
+        qreal distance;
+        int index;
+    };
+    static bool fartherEntry(const Entry &entry1, const Entry &entry2);
+
+    qreal distance(int x, int y) const;
+    void push(int x, int y);
+    void rebuild();
+
+    int m_width;
+    int m_height;
+    QVector<char> m_states;
+    QVector<Entry> m_heap;
+    QRect m_range;
+    QPointF m_center;
+    int m_maxQueueDepth;
+    int m_pendingCount;
+    int m_rebuildCount;
+};
+
+#endif
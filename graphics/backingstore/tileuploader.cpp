@@ -0,0 +1,251 @@
+/*
+    This file is part of the Ofi Labs X2 project.
+
+    Copyright (C) 2011 Ariya Hidayat <ariya.hidayat@gmail.com>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of
+    the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "tileuploader.h"
+#include "texturebuffer.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+// None of these is in the OpenGL 1.1 headers.
+#ifndef APIENTRY
+#define APIENTRY
+#endif
+#ifndef GL_BGRA
+#define GL_BGRA 0x80E1
+#endif
+#ifndef GL_UNSIGNED_INT_8_8_8_8_REV
+#define GL_UNSIGNED_INT_8_8_8_8_REV 0x8367
+#endif
+#ifndef GL_PIXEL_UNPACK_BUFFER
+#define GL_PIXEL_UNPACK_BUFFER 0x88EC
+#endif
+#ifndef GL_STREAM_DRAW
+#define GL_STREAM_DRAW 0x88E0
+#endif
+#ifndef GL_WRITE_ONLY
+#define GL_WRITE_ONLY 0x88B9
+#endif
+#ifndef GL_SYNC_GPU_COMMANDS_COMPLETE
+#define GL_SYNC_GPU_COMMANDS_COMPLETE 0x9117
+#endif
+#ifndef GL_ALREADY_SIGNALED
+#define GL_ALREADY_SIGNALED 0x911A
+#endif
+#ifndef GL_CONDITION_SATISFIED
+#define GL_CONDITION_SATISFIED 0x911C
+#endif
+
+// Buffers in the ring: about the tiles uploaded between two frames.
+const int RingSize = 8;
+
+const int TileBytes = TileDim * TileDim * 4;
+
+typedef struct __GLsync *SyncObject;
+
+struct TileUploaderFunctions
+{
+    void (APIENTRY *genBuffers)(GLsizei, GLuint*);
+    void (APIENTRY *deleteBuffers)(GLsizei, const GLuint*);
+    void (APIENTRY *bindBuffer)(GLenum, GLuint);
+    void (APIENTRY *bufferData)(GLenum, ptrdiff_t, const GLvoid*, GLenum);
+    GLvoid* (APIENTRY *mapBuffer)(GLenum, GLenum);
+    GLboolean (APIENTRY *unmapBuffer)(GLenum);
+
+    SyncObject (APIENTRY *fenceSync)(GLenum, GLbitfield);
+    GLenum (APIENTRY *clientWaitSync)(SyncObject, GLbitfield, quint64);
+    void (APIENTRY *deleteSync)(SyncObject);
+};
+
+template <typename T>
+static bool resolve(const QGLContext *context, T *function, const char *name)
+{
+    *function = reinterpret_cast<T>(context->getProcAddress(QLatin1String(name)));
+    if (!*function)
+        *function = reinterpret_cast<T>(context->getProcAddress(QString::fromLatin1(name) + QLatin1String("ARB")));
+    return *function != 0;
+}
+
+// GL_VERSION starts with "major.minor", vendor information may follow.
+static bool hasVersion(const char *version, int major, int minor)
+{
+    int versionMajor = 0;
+    int versionMinor = 0;
+    if (sscanf(version, "%d.%d", &versionMajor, &versionMinor) != 2)
+        return false;
+    return versionMajor > major || (versionMajor == major && versionMinor >= minor);
+}
+
+// A whole name of the space separated list, not merely a prefix of one.
+static bool hasExtension(const char *extensions, const char *name)
+{
+    int length = strlen(name);
+    for (const char *p = strstr(extensions, name); p; p = strstr(p + length, name)) {
+        if ((p == extensions || p[-1] == ' ') && (p[length] == ' ' || p[length] == '\0'))
+            return true;
+    }
+    return false;
+}
+
+TileUploader::TileUploader()
+    : m_initialized(false)
+    , m_functions(0)
+    , m_next(0)
+    , m_streamedCount(0)
+    , m_directCount(0)
+    , m_orphanedCount(0)
+{
+}
+
+TileUploader::~TileUploader()
+{
+    if (m_functions) {
+        for (int i = 0; i < m_fences.count(); ++i)
+            if (m_fences.at(i))
+                m_functions->deleteSync(static_cast<SyncObject>(m_fences.at(i)));
+        m_functions->deleteBuffers(m_buffers.count(), m_buffers.constData());
+    }
+    delete m_functions;
+}
+
+void TileUploader::upload(GLuint texture, int x, int y, const QImage &tile)
+{
+    if (!m_initialized)
+        initialize();
+    if (!m_functions) {
+        uploadDirect(texture, x, y, tile);
+        return;
+    }
+
+    TileUploaderFunctions *f = m_functions;
+    GLuint buffer = m_buffers.at(m_next);
+    SyncObject fence = static_cast<SyncObject>(m_fences.at(m_next));
+    f->bindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+
+    // A buffer which is still being read gets new storage, the driver
+    // frees the old one once the transfer is over. No waiting either way.
+    bool busy = false;
+    if (fence) {
+        GLenum status = f->clientWaitSync(fence, 0, 0);
+        busy = (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED);
+        f->deleteSync(fence);
+        m_fences[m_next] = 0;
+    }
+    if (busy) {
+        f->bufferData(GL_PIXEL_UNPACK_BUFFER, TileBytes, 0, GL_STREAM_DRAW);
+        ++m_orphanedCount;
+    }
+
+    void *data = f->mapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+    if (!data) {
+        f->bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        uploadDirect(texture, x, y, tile);
+        return;
+    }
+    for (int row = 0; row < TileDim; ++row)
+        memcpy(static_cast<uchar*>(data) + row * TileDim * 4, tile.constScanLine(row), TileDim * 4);
+    f->unmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+    // With a bound unpack buffer, the pointer is an offset into it.
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, TileDim, TileDim,
+                    GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, 0);
+    f->bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    m_fences[m_next] = f->fenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    m_next = (m_next + 1) % m_buffers.count();
+    ++m_streamedCount;
+}
+
+bool TileUploader::isStreaming() const
+{
+    return m_functions != 0;
+}
+
+int TileUploader::streamedCount() const
+{
+    return m_streamedCount;
+}
+
+int TileUploader::directCount() const
+{
+    return m_directCount;
+}
+
+int TileUploader::orphanedCount() const
+{
+    return m_orphanedCount;
+}
+
+// Buffer objects are OpenGL 1.5, pixel buffers need 2.1 or
+// ARB_pixel_buffer_object and fences 3.2 or ARB_sync. The entry points may
+// resolve even when the context does not support them, only the version
+// and the extension string tell.
+void TileUploader::initialize()
+{
+    m_initialized = true;
+
+    const QGLContext *context = QGLContext::currentContext();
+    const char *extensions = reinterpret_cast<const char*>(glGetString(GL_EXTENSIONS));
+    const char *version = reinterpret_cast<const char*>(glGetString(GL_VERSION));
+    if (!context || !extensions || !version)
+        return;
+    bool pixelBuffers = hasVersion(version, 2, 1) || hasExtension(extensions, "GL_ARB_pixel_buffer_object");
+    bool sync = hasVersion(version, 3, 2) || hasExtension(extensions, "GL_ARB_sync");
+    if (!pixelBuffers || !sync)
+        return;
+
+    TileUploaderFunctions *f = new TileUploaderFunctions;
+    bool ok = resolve(context, &f->genBuffers, "glGenBuffers")
+        && resolve(context, &f->deleteBuffers, "glDeleteBuffers")
+        && resolve(context, &f->bindBuffer, "glBindBuffer")
+        && resolve(context, &f->bufferData, "glBufferData")
+        && resolve(context, &f->mapBuffer, "glMapBuffer")
+        && resolve(context, &f->unmapBuffer, "glUnmapBuffer")
+        && resolve(context, &f->fenceSync, "glFenceSync")
+        && resolve(context, &f->clientWaitSync, "glClientWaitSync")
+        && resolve(context, &f->deleteSync, "glDeleteSync");
+    if (!ok) {
+        delete f;
+        return;
+    }
+
+    m_buffers.resize(RingSize);
+    m_fences.fill(0, RingSize);
+    f->genBuffers(RingSize, m_buffers.data());
+    for (int i = 0; i < RingSize; ++i) {
+        f->bindBuffer(GL_PIXEL_UNPACK_BUFFER, m_buffers.at(i));
+        f->bufferData(GL_PIXEL_UNPACK_BUFFER, TileBytes, 0, GL_STREAM_DRAW);
+    }
+    f->bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    m_functions = f;
+}
+
+// ARGB32 is BGRA in memory on little endian, the packed type takes care of
+// big endian. Thus the image is uploaded as is, without any conversion.
+void TileUploader::uploadDirect(GLuint texture, int x, int y, const QImage &tile)
+{
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, TileDim, TileDim,
+                    GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, tile.constBits());
+    ++m_directCount;
+}
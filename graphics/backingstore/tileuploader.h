@@ -0,0 +1,65 @@
+/*
+    This file is part of the Ofi Labs X2 project.
+
+    Copyright (C) 2011 Ariya Hidayat <ariya.hidayat@gmail.com>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of
+    the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef OFILABS_TILEUPLOADER
+#define OFILABS_TILEUPLOADER
+
+#include <QGLWidget>
+#include <QImage>
+#include <QVector>
+
+struct TileUploaderFunctions;
+
+// Streams tiles to their textures through a ring of pixel buffer objects.
+// The tile is copied into the next buffer of the ring and the transfer to
+// the texture happens asynchronously, the CPU does not wait for it. A fence
+// tells when a buffer can be written again, a busy one is orphaned.
+//
+// Without pixel buffer objects or fences (before OpenGL 3.2 or ARB_sync),
+// tiles are uploaded directly.
+class TileUploader
+{
+public:
+    TileUploader();
+    ~TileUploader();
+
+    // Uploads a TileDim x TileDim ARGB32 tile at (x, y) of the texture.
+    void upload(GLuint texture, int x, int y, const QImage &tile);
+
+    bool isStreaming() const;
+    int streamedCount() const;
+    int directCount() const;
+    // Uploads which had to orphan their buffer, as it was still in use.
+    int orphanedCount() const;
+
+private:
+    void initialize();
+    void uploadDirect(GLuint texture, int x, int y, const QImage &tile);
+
+    bool m_initialized;
+    TileUploaderFunctions *m_functions;
+    QVector<GLuint> m_buffers;
+    QVector<void*> m_fences;
+    int m_next;
+    int m_streamedCount;
+    int m_directCount;
+    int m_orphanedCount;
+};
+
+#endif
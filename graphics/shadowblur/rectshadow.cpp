@@ -0,0 +1,114 @@
+/*
+  This file is part of the Ofi Labs X2 project.
+
+  Copyright (C) 2010 Ariya Hidayat <ariya.hidayat@gmail.com>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+  THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "rectshadow.h"
+#include "shadowblur.h"
+#include "shadowcache.h"
+
+#include <QPainter>
+
+#include <math.h>
+
+// Distance from the edge of the rectangle, inwards, over which the shadow
+// still varies: the rounded corner plus the reach of the blur.
+static int cornerSize(qreal cornerRadius, int radius)
+{
+    return int(ceil(qMax(cornerRadius, qreal(0)))) + shadowBlurExtent(radius);
+}
+
+// Blurs a rounded rectangle of the given size, surrounded by a transparent
+// margin which is wide enough for the shadow to fade out completely.
+static QImage blurredRect(const QSize& size, qreal cornerRadius, int radius,
+                          const QColor& color, ShadowCache* cache)
+{
+    int margin = shadowBlurExtent(radius) + 1;
+    QImage image(size.width() + 2 * margin, size.height() + 2 * margin,
+                 QImage::Format_ARGB32_Premultiplied);
+    image.fill(0);
+
+    QPainter p(&image);
+    p.setRenderHint(QPainter::Antialiasing, true);
+    p.setPen(Qt::NoPen);
+    p.setBrush(Qt::black);
+    if (cornerRadius > 0)
+        p.drawRoundedRect(QRectF(QPointF(margin, margin), QSizeF(size)), cornerRadius, cornerRadius);
+    else
+        p.drawRect(QRect(QPoint(margin, margin), size));
+    p.end();
+
+    if (cache)
+        return cache->shadow(image, radius, color);
+    shadowBlur(image, radius, color);
+    return image;
+}
+
+QImage rectShadowTemplate(qreal cornerRadius, int radius, const QColor& color, ShadowCache* cache)
+{
+    int dim = 2 * cornerSize(cornerRadius, radius) + 1;
+    return blurredRect(QSize(dim, dim), cornerRadius, radius, color, cache);
+}
+
+void drawRectShadow(QPainter* painter, const QRect& rect, qreal cornerRadius, int radius,
+                    const QColor& color, ShadowCache* cache)
+{
+    if (rect.isEmpty())
+        return;
+
+    int margin = shadowBlurExtent(radius) + 1;
+    int corner = cornerSize(cornerRadius, radius);
+    QRect target = rect.adjusted(-margin, -margin, margin, margin);
+
+    // Too small for the corners not to influence each other, there is
+    // no shortcut but to blur the real thing.
+    if (rect.width() < 2 * corner + 1 || rect.height() < 2 * corner + 1) {
+        painter->drawImage(target.topLeft(), blurredRect(rect.size(), cornerRadius, radius, color, cache));
+        return;
+    }
+
+    QImage patch = rectShadowTemplate(cornerRadius, radius, color, cache);
+
+    // Columns and rows of the template: corner, one pixel strip, corner.
+    int side = margin + corner;
+    int sx[4] = { 0, side, side + 1, patch.width() };
+    int sy[4] = { 0, side, side + 1, patch.height() };
+    int tx[4] = { target.left(), target.left() + side, target.right() + 1 - side, target.right() + 1 };
+    int ty[4] = { target.top(), target.top() + side, target.bottom() + 1 - side, target.bottom() + 1 };
+
+    // Stretching a single pixel strip does not need any filtering.
+    bool smooth = painter->testRenderHint(QPainter::SmoothPixmapTransform);
+    painter->setRenderHint(QPainter::SmoothPixmapTransform, false);
+    for (int j = 0; j < 3; ++j) {
+        for (int i = 0; i < 3; ++i) {
+            QRect source(QPoint(sx[i], sy[j]), QPoint(sx[i + 1] - 1, sy[j + 1] - 1));
+            QRect destination(QPoint(tx[i], ty[j]), QPoint(tx[i + 1] - 1, ty[j + 1] - 1));
+            painter->drawImage(destination, patch, source);
+        }
+    }
+    painter->setRenderHint(QPainter::SmoothPixmapTransform, smooth);
+}
@@ -0,0 +1,52 @@
+/*
+  This file is part of the Ofi Labs X2 project.
+
+  Copyright (C) 2010 Ariya Hidayat <ariya.hidayat@gmail.com>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+  THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef OFILABS_RECTSHADOW
+#define OFILABS_RECTSHADOW
+
+#include <QColor>
+#include <QImage>
+#include <QRect>
+
+class QPainter;
+class ShadowCache;
+
+// The blurred shadow of a (rounded) rectangle, just large enough to hold
+// the four corners plus a one pixel wide strip of every edge and of the
+// center. Any larger shadow is the same image with the strips stretched.
+QImage rectShadowTemplate(qreal cornerRadius, int radius, const QColor& color, ShadowCache* cache = 0);
+
+// Draws the shadow cast by rect, which extends shadowBlurExtent(radius)
+// pixels beyond it, as a nine-patch built from rectShadowTemplate(). The
+// cost does not depend on the size of rect. With a cache, the template
+// is only blurred once for every corner radius, blur radius and color.
+void drawRectShadow(QPainter* painter, const QRect& rect, qreal cornerRadius, int radius,
+                    const QColor& color, ShadowCache* cache = 0);
+
+#endif
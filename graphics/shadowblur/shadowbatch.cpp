@@ -0,0 +1,233 @@
+/*
+  This file is part of the Ofi Labs X2 project.
+
+  Copyright (C) 2010 Ariya Hidayat <ariya.hidayat@gmail.com>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+  THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "shadowbatch.h"
+#include "shadowblur_p.h"
+
+#include <QtAlgorithms>
+
+#include <math.h>
+
+ShadowBlurJob::ShadowBlurJob()
+    : radius(0)
+{
+}
+
+ShadowBlurJob::ShadowBlurJob(const QImage &image, int radius, const QColor &color)
+    : image(image)
+    , radius(radius)
+    , color(color)
+{
+}
+
+// Where a job ends up in the atlas. The slot is the image plus the blur
+// extent on every side, which stays transparent before the blur.
+struct BatchSlot
+{
+    int job;
+    int radius;
+    int extent;
+    QRect rect;
+};
+
+// Taller slots first within the same radius, so that every shelf is as
+// high as its first slot and wastes little space.
+static bool slotLessThan(const BatchSlot &a, const BatchSlot &b)
+{
+    if (a.radius != b.radius)
+        return a.radius > b.radius;
+    return a.rect.height() > b.rect.height();
+}
+
+// Rows [first, last) of the atlas blurred with the same radius.
+struct BatchBand
+{
+    int radius;
+    int first;
+    int last;
+};
+
+// Lays out the slots on shelves, left to right. A new radius always
+// starts a new shelf, thus every radius covers a band of whole rows.
+static QSize packSlots(QVector<BatchSlot> &slots, QVector<BatchBand> &bands)
+{
+    qint64 area = 0;
+    int width = 0;
+    for (int i = 0; i < slots.count(); ++i) {
+        area += qint64(slots[i].rect.width()) * slots[i].rect.height();
+        width = qMax(width, slots[i].rect.width());
+    }
+    width = qMax(width, int(ceil(sqrt(double(area)))));
+
+    qSort(slots.begin(), slots.end(), slotLessThan);
+
+    int x = 0;
+    int y = 0;
+    int shelfHeight = 0;
+    for (int i = 0; i < slots.count(); ++i) {
+        BatchSlot &slot = slots[i];
+        bool newRadius = (i == 0 || slot.radius != slots[i - 1].radius);
+        if (newRadius || x + slot.rect.width() > width) {
+            y += shelfHeight;
+            x = 0;
+            shelfHeight = slot.rect.height();
+        }
+        if (newRadius) {
+            if (!bands.isEmpty())
+                bands.last().last = y;
+            BatchBand band = { slot.radius, y, y };
+            bands.append(band);
+        }
+        slot.rect.moveTopLeft(QPoint(x, y));
+        x += slot.rect.width();
+    }
+    y += shelfHeight;
+    if (!bands.isEmpty())
+        bands.last().last = y;
+
+    return QSize(width, y);
+}
+
+// Copies the alpha of every job into its slot.
+class GatherTask: public ParallelTask
+{
+public:
+    const QVector<ShadowBlurJob> *jobs;
+    const QVector<BatchSlot> *slots;
+    AlphaPlane atlas;
+
+    void run(int index)
+    {
+        const BatchSlot &slot = slots->at(index);
+        uchar* q = atlas.bits + (slot.rect.top() + slot.extent) * atlas.bytesPerLine +
+                   slot.rect.left() + slot.extent;
+        extractAlpha(jobs->at(slot.job).image, q, atlas.bytesPerLine);
+    }
+};
+
+// Turns the blurred alpha of every slot into its shadow color.
+class ColorizeTask: public ParallelTask
+{
+public:
+    const QVector<ShadowBlurJob> *jobs;
+    const QVector<BatchSlot> *slots;
+    AlphaPlane atlas;
+    uchar *resultBits;
+    int resultBytesPerLine;
+
+    void run(int index)
+    {
+        const BatchSlot &slot = slots->at(index);
+        QVector<QRgb> colorTable = premultipliedColorTable(jobs->at(slot.job).color);
+        const QRgb* table = colorTable.constData();
+
+        for (int y = slot.rect.top(); y <= slot.rect.bottom(); ++y) {
+            const uchar* p = atlas.bits + y * atlas.bytesPerLine + slot.rect.left();
+            QRgb* q = reinterpret_cast<QRgb*>(resultBits + y * resultBytesPerLine) + slot.rect.left();
+            for (int x = 0; x < slot.rect.width(); ++x)
+                q[x] = table[p[x]];
+        }
+    }
+};
+
+// The slots of a band do not disturb each other: a pixel of a slot is at
+// least extent + 1 pixels away from the content of any other slot, which
+// is beyond the reach of the blur. Likewise the edges of the atlas are
+// transparent, hence the result is the same as blurring every image on
+// its own after padding it with the extent.
+QImage shadowBlurBatch(const QVector<ShadowBlurJob> &jobs, QVector<QRect> *rects,
+                       const ShadowBlurOptions &options)
+{
+    if (rects)
+        *rects = QVector<QRect>(jobs.count());
+
+    QVector<BatchSlot> slots;
+    for (int i = 0; i < jobs.count(); ++i) {
+        const ShadowBlurJob &job = jobs.at(i);
+        if (job.image.isNull())
+            continue;
+        BatchSlot slot;
+        slot.job = i;
+        slot.radius = qBound(0, job.radius, 128);
+        slot.extent = shadowBlurExtent(slot.radius);
+        slot.rect = QRect(QPoint(0, 0), job.image.size()).adjusted(0, 0, 2 * slot.extent, 2 * slot.extent);
+        slots.append(slot);
+    }
+    if (slots.isEmpty())
+        return QImage();
+
+    QVector<BatchBand> bands;
+    QSize size = packSlots(slots, bands);
+
+    // Gathering and colorizing are split per job, the blur itself decides
+    // on its own how to spread every band.
+    int threadCount = options.threadCount;
+    if (qint64(size.width()) * size.height() < options.threadThreshold)
+        threadCount = 1;
+
+    QImage result(size, QImage::Format_ARGB32_Premultiplied);
+    if (result.isNull())
+        return result;
+    result.fill(0);
+
+    QVector<uchar> buffer(size.width() * size.height(), 0);
+    AlphaPlane atlas;
+    atlas.bits = buffer.data();
+    atlas.pixelStride = 1;
+    atlas.bytesPerLine = size.width();
+    atlas.width = size.width();
+    atlas.height = size.height();
+    atlas.colorTable = 0;
+
+    GatherTask gather;
+    gather.jobs = &jobs;
+    gather.slots = &slots;
+    gather.atlas = atlas;
+    runParallel(&gather, slots.count(), threadCount);
+
+    for (int i = 0; i < bands.count(); ++i) {
+        const BatchBand &band = bands.at(i);
+        QRect rect(0, band.first, atlas.width, band.last - band.first);
+        blurAlphaPlane(alphaSubPlane(atlas, rect), band.radius, options);
+    }
+
+    ColorizeTask colorize;
+    colorize.jobs = &jobs;
+    colorize.slots = &slots;
+    colorize.atlas = atlas;
+    colorize.resultBits = result.bits();
+    colorize.resultBytesPerLine = result.bytesPerLine();
+    runParallel(&colorize, slots.count(), threadCount);
+
+    if (rects) {
+        for (int i = 0; i < slots.count(); ++i)
+            (*rects)[slots.at(i).job] = slots.at(i).rect;
+    }
+    return result;
+}
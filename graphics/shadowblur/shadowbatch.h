@@ -0,0 +1,63 @@
+/*
+  This file is part of the Ofi Labs X2 project.
+
+  Copyright (C) 2010 Ariya Hidayat <ariya.hidayat@gmail.com>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+  THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef OFILABS_SHADOWBATCH
+#define OFILABS_SHADOWBATCH
+
+#include "shadowblur.h"
+
+#include <QColor>
+#include <QImage>
+#include <QRect>
+#include <QVector>
+
+struct ShadowBlurJob
+{
+    ShadowBlurJob();
+    ShadowBlurJob(const QImage &image, int radius, const QColor &color);
+
+    QImage image;
+    int radius;
+    QColor color;
+};
+
+// Blurs the shadows of many (typically small) images in one go. The alpha
+// of every job is packed into a shared 8-bit atlas, with shelves grouped
+// by radius, the atlas is blurred once per radius, spread across the
+// thread pool, and every shadow is colorized into the returned
+// Format_ARGB32_Premultiplied atlas.
+//
+// rects[i] receives where the shadow of jobs[i] is (or QRect() for a null
+// image). Unlike shadowBlur(), the shadow is not clipped to the image: the
+// rect is the image grown by shadowBlurExtent() on every side, i.e. the
+// top-left corner of the image maps to rects[i].topLeft() plus the extent.
+QImage shadowBlurBatch(const QVector<ShadowBlurJob> &jobs, QVector<QRect> *rects,
+                       const ShadowBlurOptions &options = ShadowBlurOptions());
+
+#endif
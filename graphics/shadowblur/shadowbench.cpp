@@ -0,0 +1,837 @@
+/*
+  This file is part of the Ofi Labs X2 project.
+
+  Copyright (C) 2010 Ariya Hidayat <ariya.hidayat@gmail.com>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+  THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Headless benchmark for shadowBlur().
+//
+// Without any mode, the suite times shadowBlur() over a matrix of image
+// sizes, blur radii and alpha densities. The result can be saved as a
+// baseline (--save file) and a later run compared against it (--compare
+// file), which reports every case slower by more than --threshold percent
+// and exits with a non-zero code if there is any.
+//
+// --passes times the horizontal and vertical passes alone across image
+// widths, --accuracy checks the downsampled blur against the full one and
+// the Gaussian against the exact convolution, failing beyond fixed bounds,
+// --batch compares many small shadowBlur() calls against one batch,
+// --check requires every SIMD kernel to match the scalar one to the bit
+// (and the fused colorize and the batch to match plain shadowBlur())
+// and --rect requires drawRectShadow() to match shadowBlur() of a filled
+// rect, timing both.
+
+#include "rectshadow.h"
+#include "shadowbatch.h"
+#include "shadowblur.h"
+#include "shadowblur_p.h"
+#include "shadowcache.h"
+
+#include <QtCore>
+#include <QImage>
+#include <QPainter>
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+struct Settings
+{
+    int warmup;
+    int repeat;
+    int height;
+    int radius;
+    qreal threshold;
+    QString saveFile;
+    QString compareFile;
+};
+
+// Simple deterministic generator, to get the same images in every run.
+static uint nextRandom(uint& seed)
+{
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) & 0x7fff;
+}
+
+static QImage createTestImage(int width, int height)
+{
+    QImage image(width, height, QImage::Format_ARGB32_Premultiplied);
+    for (int y = 0; y < height; ++y) {
+        QRgb* line = reinterpret_cast<QRgb*>(image.scanLine(y));
+        for (int x = 0; x < width; ++x) {
+            int alpha = (x ^ y) & 255;
+            line[x] = qRgba(0, 0, 0, alpha);
+        }
+    }
+    return image;
+}
+
+// Random alpha values inside a centered square which covers the given
+// percentage of the image, the rest is transparent.
+static QImage createDensityImage(int size, int density)
+{
+    QImage image(size, size, QImage::Format_ARGB32_Premultiplied);
+    image.fill(0);
+
+    int dim = qMax(1, qRound(size * sqrt(density / 100.0)));
+    int offset = (size - dim) / 2;
+    uint seed = size + density;
+    for (int y = offset; y < offset + dim; ++y) {
+        QRgb* line = reinterpret_cast<QRgb*>(image.scanLine(y));
+        for (int x = offset; x < offset + dim; ++x) {
+            int alpha = nextRandom(seed) & 255;
+            line[x] = qRgba(0, 0, 0, alpha);
+        }
+    }
+    return image;
+}
+
+// A soft-edged disc in the middle of a transparent square, roughly what
+// a typical drop shadow source looks like.
+static QImage createShapeImage(int size)
+{
+    QImage image(size, size, QImage::Format_ARGB32_Premultiplied);
+    qreal center = size / 2.0;
+    qreal radius = size / 3.0;
+    for (int y = 0; y < size; ++y) {
+        QRgb* line = reinterpret_cast<QRgb*>(image.scanLine(y));
+        for (int x = 0; x < size; ++x) {
+            qreal dx = x + 0.5 - center;
+            qreal dy = y + 0.5 - center;
+            qreal d = radius - sqrt(dx * dx + dy * dy);
+            int alpha = qBound(0, qRound(d * 255), 255);
+            line[x] = qRgba(0, 0, 0, alpha);
+        }
+    }
+    return image;
+}
+
+// Returns the best time, in nanoseconds, of several runs.
+template <typename Function>
+static qint64 measure(Function function, int repeat)
+{
+    function();
+
+    qint64 best = -1;
+    QElapsedTimer timer;
+    for (int i = 0; i < repeat; ++i) {
+        timer.start();
+        function();
+        qint64 elapsed = timer.nsecsElapsed();
+        if (best < 0 || elapsed < best)
+            best = elapsed;
+    }
+    return best;
+}
+
+// Returns the median time, in nanoseconds, of shadowBlur() on a fresh
+// copy of the source (the copy itself is not timed).
+static qint64 measureShadowBlur(const QImage& source, int radius, const ShadowBlurOptions& options,
+                                const Settings& settings)
+{
+    QVector<qint64> times;
+    QElapsedTimer timer;
+    for (int i = 0; i < settings.warmup + settings.repeat; ++i) {
+        QImage image = source.copy();
+        timer.start();
+        shadowBlur(image, radius, Qt::black, options);
+        qint64 elapsed = timer.nsecsElapsed();
+        if (i >= settings.warmup)
+            times.append(elapsed);
+    }
+    qSort(times.begin(), times.end());
+    return times.at(times.count() / 2);
+}
+
+struct HorizontalPass
+{
+    AlphaPlane plane;
+    BoxBlurKernel kernel;
+    BoxBlurLanesFunction blurLanes;
+    void operator()() const { blurHorizontal(plane, kernel, blurLanes); }
+};
+
+struct VerticalPass
+{
+    AlphaPlane plane;
+    BoxBlurKernel kernel;
+    BoxBlurLanesFunction blurLanes;
+    int blockWidth;
+    void operator()() const { blurVertical(plane, kernel, blurLanes, blockWidth); }
+};
+
+struct ShadowBlurRun
+{
+    QImage source;
+    int radius;
+    ShadowBlurOptions options;
+    void operator()() const
+    {
+        QImage image = source;
+        shadowBlur(image, radius, Qt::black, options);
+    }
+};
+
+static double throughput(qint64 pixels, qint64 nsecs)
+{
+    return (nsecs > 0) ? pixels * 1000.0 / nsecs : 0;
+}
+
+// Baseline files hold one "size radius density ns/pixel" line per case.
+static QString caseKey(int size, int radius, int density)
+{
+    return QString("%1 %2 %3").arg(size).arg(radius).arg(density);
+}
+
+static QHash<QString, double> loadBaseline(const QString& fileName)
+{
+    QHash<QString, double> baseline;
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        fprintf(stderr, "Can not read %s\n", qPrintable(fileName));
+        return baseline;
+    }
+    QTextStream stream(&file);
+    while (!stream.atEnd()) {
+        QString line = stream.readLine().trimmed();
+        if (line.isEmpty() || line.startsWith('#'))
+            continue;
+        QStringList fields = line.split(' ', QString::SkipEmptyParts);
+        if (fields.count() == 4)
+            baseline[fields.mid(0, 3).join(" ")] = fields.at(3).toDouble();
+    }
+    return baseline;
+}
+
+static int runSuite(const Settings& settings)
+{
+    static const int sizes[] = { 64, 256, 1024, 4096 };
+    static const int radii[] = { 1, 4, 16, 64, 128 };
+    static const int densities[] = { 1, 25, 100 };
+
+    QHash<QString, double> baseline;
+    if (!settings.compareFile.isEmpty())
+        baseline = loadBaseline(settings.compareFile);
+
+    QFile saveFile(settings.saveFile);
+    QTextStream save(&saveFile);
+    if (!settings.saveFile.isEmpty()) {
+        if (saveFile.open(QIODevice::WriteOnly | QIODevice::Text))
+            save << "# size radius density ns/pixel\n";
+        else
+            fprintf(stderr, "Can not write %s\n", qPrintable(settings.saveFile));
+    }
+
+    printf("shadowBlur(), median of %d runs after %d warm-up runs\n\n", settings.repeat, settings.warmup);
+    printf("%6s %6s %8s %10s %10s %10s\n", "size", "radius", "density", "Mpix/s", "ns/pixel", "baseline");
+
+    int regressions = 0;
+    for (unsigned s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        for (unsigned d = 0; d < sizeof(densities) / sizeof(densities[0]); ++d) {
+            QImage source = createDensityImage(sizes[s], densities[d]);
+            qint64 pixels = qint64(sizes[s]) * sizes[s];
+
+            for (unsigned r = 0; r < sizeof(radii) / sizeof(radii[0]); ++r) {
+                qint64 nsecs = measureShadowBlur(source, radii[r], ShadowBlurOptions(), settings);
+                double nsPerPixel = double(nsecs) / pixels;
+                QString key = caseKey(sizes[s], radii[r], densities[d]);
+
+                QByteArray verdict;
+                if (baseline.contains(key)) {
+                    double change = (nsPerPixel / baseline.value(key) - 1) * 100;
+                    verdict = QString("%1%2%").arg(change >= 0 ? "+" : "").arg(change, 0, 'f', 1).toLatin1();
+                    if (change > settings.threshold) {
+                        verdict += " SLOWER";
+                        ++regressions;
+                    }
+                }
+
+                printf("%6d %6d %7d%% %10.1f %10.3f %10s\n", sizes[s], radii[r], densities[d],
+                       throughput(pixels, nsecs), nsPerPixel, verdict.constData());
+                fflush(stdout);
+
+                if (saveFile.isOpen())
+                    save << key << ' ' << QString::number(nsPerPixel, 'f', 4) << '\n';
+            }
+        }
+    }
+
+    if (!baseline.isEmpty()) {
+        printf("\n%d case(s) more than %.1f%% slower than %s\n", regressions,
+               settings.threshold, qPrintable(settings.compareFile));
+    }
+    return (regressions > 0) ? 1 : 0;
+}
+
+static void runPasses(const Settings& settings)
+{
+    int height = settings.height;
+    BoxBlurLanesFunction blurLanes = boxBlurLanesFunction(shadowBlurInstructionSet());
+    BoxBlurKernel kernel = boxBlurKernel(settings.radius);
+
+    printf("Image height %d, radius %d, best of %d runs, throughput in Mpix/s\n\n",
+           height, settings.radius, settings.repeat);
+    printf("%8s %12s %12s %12s %10s\n", "width", "horizontal", "vertical", "blocked", "speedup");
+
+    static const int widths[] = { 256, 512, 1024, 2048, 4096 };
+    for (unsigned w = 0; w < sizeof(widths) / sizeof(widths[0]); ++w) {
+        int width = widths[w];
+        QImage image = createTestImage(width, height);
+
+        AlphaPlane plane;
+        plane.bits = image.bits() + ArgbAlphaOffset;
+        plane.pixelStride = 4;
+        plane.bytesPerLine = image.bytesPerLine();
+        plane.width = width;
+        plane.height = height;
+        plane.colorTable = 0;
+
+        HorizontalPass horizontal = { plane, kernel, blurLanes };
+        VerticalPass vertical = { plane, kernel, blurLanes, BlurLaneGroup };
+        VerticalPass blocked = { plane, kernel, blurLanes, BlurColumnBlock };
+
+        qint64 pixels = qint64(width) * height;
+        qint64 horizontalTime = measure(horizontal, settings.repeat);
+        qint64 verticalTime = measure(vertical, settings.repeat);
+        qint64 blockedTime = measure(blocked, settings.repeat);
+
+        printf("%8d %12.1f %12.1f %12.1f %9.2fx\n", width,
+               throughput(pixels, horizontalTime),
+               throughput(pixels, verticalTime),
+               throughput(pixels, blockedTime),
+               (blockedTime > 0) ? double(verticalTime) / blockedTime : 0.0);
+    }
+}
+
+// Largest and mean difference of the alpha, in alpha units.
+struct AlphaError
+{
+    int max;
+    double mean;
+};
+
+static AlphaError alphaError(const QImage& reference, const QImage& result)
+{
+    AlphaError error = { 0, 0 };
+    qint64 total = 0;
+    for (int y = 0; y < reference.height(); ++y) {
+        const QRgb* p = reinterpret_cast<const QRgb*>(reference.constScanLine(y));
+        const QRgb* q = reinterpret_cast<const QRgb*>(result.constScanLine(y));
+        for (int x = 0; x < reference.width(); ++x) {
+            int difference = qAbs(qAlpha(p[x]) - qAlpha(q[x]));
+            error.max = qMax(error.max, difference);
+            total += difference;
+        }
+    }
+    error.mean = double(total) / (qint64(reference.width()) * reference.height());
+    return error;
+}
+
+// The exact Gaussian, by convolution in double precision with the kernel
+// cut at shadowBlurGaussianExtent(), i.e. 5 sigma. Pixels beyond the image
+// are transparent.
+static QImage gaussianReference(const QImage& source, qreal sigma)
+{
+    int width = source.width();
+    int height = source.height();
+    int extent = shadowBlurGaussianExtent(sigma);
+    QVector<double> weights(2 * extent + 1);
+    double sum = 0;
+    for (int i = -extent; i <= extent; ++i)
+        sum += weights[i + extent] = exp(-i * i / (2 * sigma * sigma));
+    for (int i = 0; i < weights.count(); ++i)
+        weights[i] /= sum;
+
+    QVector<double> alpha(width * height);
+    for (int y = 0; y < height; ++y) {
+        const QRgb* line = reinterpret_cast<const QRgb*>(source.constScanLine(y));
+        for (int x = 0; x < width; ++x)
+            alpha[y * width + x] = qAlpha(line[x]);
+    }
+
+    QVector<double> rows(width * height, 0);
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x)
+            for (int i = qMax(-extent, -x); i <= qMin(extent, width - 1 - x); ++i)
+                rows[y * width + x] += weights[i + extent] * alpha[y * width + x + i];
+
+    QImage result(width, height, QImage::Format_ARGB32_Premultiplied);
+    for (int y = 0; y < height; ++y) {
+        QRgb* line = reinterpret_cast<QRgb*>(result.scanLine(y));
+        for (int x = 0; x < width; ++x) {
+            double value = 0;
+            for (int i = qMax(-extent, -y); i <= qMin(extent, height - 1 - y); ++i)
+                value += weights[i + extent] * rows[(y + i) * width + x];
+            line[x] = qRgba(0, 0, 0, qBound(0, qRound(value), 255));
+        }
+    }
+    return result;
+}
+
+// Bounds for the approximations, in alpha units, with some margin over
+// what the shapes of createShapeImage() give. The recursive Gaussian is
+// least accurate for small sigmas.
+static const int DownsampleMaxError = 6;
+static const double DownsampleMeanError = 1.5;
+
+struct GaussianBound
+{
+    qreal sigma;
+    int maxError;
+    double meanError;
+};
+
+static const GaussianBound gaussianBounds[] = {
+    { 1, 13, 0.75 },
+    { 2.5, 8, 1.0 },
+    { 4, 7, 1.0 },
+    { 8, 7, 1.0 },
+    { 16, 7, 1.25 },
+    { 32, 7, 1.25 }
+};
+
+// Compares the downsampled fast path against the full resolution blur and
+// the recursive Gaussian against the exact one. Returns the number of
+// cases out of bounds.
+static int runAccuracy(const Settings& settings)
+{
+    // The bounds hold for shapes at least twice the largest radius.
+    int size = qMax(256, settings.height);
+    QImage source = createShapeImage(size);
+    int failures = 0;
+
+    printf("Downsampled blur of a %dx%d shape against the full one, error in alpha units (0-255)\n\n",
+           size, size);
+    printf("%8s %10s %10s %10s %10s\n", "radius", "threshold", "max error", "mean error", "speedup");
+
+    static const int radii[] = { 16, 24, 32, 48, 64, 96, 128 };
+    static const int thresholds[] = { 8, 16 };
+    for (unsigned r = 0; r < sizeof(radii) / sizeof(radii[0]); ++r) {
+        ShadowBlurRun full = { source, radii[r], ShadowBlurOptions() };
+        QImage reference = source;
+        shadowBlur(reference, full.radius, Qt::black, full.options);
+        qint64 fullTime = measure(full, settings.repeat);
+
+        for (unsigned t = 0; t < sizeof(thresholds) / sizeof(thresholds[0]); ++t) {
+            ShadowBlurRun fast = full;
+            fast.options.downsampleRadius = thresholds[t];
+            QImage result = source;
+            shadowBlur(result, fast.radius, Qt::black, fast.options);
+            qint64 fastTime = measure(fast, settings.repeat);
+
+            AlphaError error = alphaError(reference, result);
+            bool failed = error.max > DownsampleMaxError || error.mean > DownsampleMeanError;
+            failures += failed;
+            printf("%8d %10d %10d %10.3f %9.2fx%s\n", radii[r], thresholds[t], error.max, error.mean,
+                   (fastTime > 0) ? double(fullTime) / fastTime : 0.0, failed ? "  FAILED" : "");
+        }
+    }
+
+    // The shape leaves room for the whole extent of the blur.
+    printf("\nGaussian blur against the exact convolution\n\n");
+    printf("%8s %10s %10s %10s %10s %10s\n", "sigma", "size", "max error", "mean error", "max bound",
+           "mean bound");
+    for (unsigned i = 0; i < sizeof(gaussianBounds) / sizeof(gaussianBounds[0]); ++i) {
+        const GaussianBound& bound = gaussianBounds[i];
+        int shapeSize = qMax(64, int(ceil(32 * bound.sigma)));
+        QImage shape = createShapeImage(shapeSize);
+        QImage reference = gaussianReference(shape, bound.sigma);
+        QImage result = shape;
+        shadowBlurGaussian(result, bound.sigma, Qt::black);
+
+        AlphaError error = alphaError(reference, result);
+        bool failed = error.max > bound.maxError || error.mean > bound.meanError;
+        failures += failed;
+        printf("%8.1f %10d %10d %10.3f %10d %10.2f%s\n", bound.sigma, shapeSize, error.max, error.mean,
+               bound.maxError, bound.meanError, failed ? "  FAILED" : "");
+    }
+
+    printf("\n%d case(s) out of bounds (downsampled: max %d, mean %.2f)\n", failures,
+           DownsampleMaxError, DownsampleMeanError);
+    return failures;
+}
+
+struct SingleShadows
+{
+    QVector<ShadowBlurJob> jobs;
+    void operator()() const
+    {
+        for (int i = 0; i < jobs.count(); ++i) {
+            QImage image = jobs.at(i).image.copy();
+            shadowBlur(image, jobs.at(i).radius, jobs.at(i).color);
+        }
+    }
+};
+
+struct BatchShadows
+{
+    QVector<ShadowBlurJob> jobs;
+    void operator()() const
+    {
+        QVector<QRect> rects;
+        shadowBlurBatch(jobs, &rects);
+    }
+};
+
+// Random alpha values everywhere but in a transparent border, to get a
+// dirty area which does not start on a vector boundary either.
+static QImage createRandomImage(int width, int height, uint seed)
+{
+    QImage image(width, height, QImage::Format_ARGB32_Premultiplied);
+    image.fill(0);
+    for (int y = height / 8; y < height - height / 8; ++y) {
+        QRgb* line = reinterpret_cast<QRgb*>(image.scanLine(y));
+        for (int x = width / 8; x < width - width / 8; ++x)
+            line[x] = qRgba(0, 0, 0, nextRandom(seed) & 255);
+    }
+    return image;
+}
+
+static bool sameImage(const QImage& image1, const QImage& image2)
+{
+    if (image1.size() != image2.size() || image1.format() != image2.format())
+        return false;
+    int bytes = image1.width() * image1.depth() / 8;
+    for (int y = 0; y < image1.height(); ++y) {
+        if (memcmp(image1.constScanLine(y), image2.constScanLine(y), bytes))
+            return false;
+    }
+    return true;
+}
+
+// Translucent colors, whose premultiplication rounds differently.
+static const QColor checkColors[] = {
+    QColor(0, 0, 0, 160), QColor(255, 0, 0, 128), QColor(30, 144, 255, 77),
+    QColor(250, 128, 114, 201), QColor(255, 255, 255, 1), QColor(12, 200, 90, 255)
+};
+
+// The colorize pass fused into the blur against the QPainter SourceIn
+// fill it replaces. Returns the number of mismatches.
+static int checkFusedColorize()
+{
+    static const int sizes[][2] = { { 1, 1 }, { 17, 9 }, { 100, 64 }, { 257, 131 } };
+    static const int radii[] = { 1, 5, 16, 64 };
+
+    int mismatches = 0;
+    for (unsigned c = 0; c < sizeof(checkColors) / sizeof(checkColors[0]); ++c) {
+        const QColor& color = checkColors[c];
+        for (unsigned s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+            QImage source = createRandomImage(sizes[s][0], sizes[s][1], sizes[s][0] + c);
+            for (int r = 0; r <= int(sizeof(radii) / sizeof(radii[0])); ++r) {
+                ShadowBlurOptions fused;
+                ShadowBlurOptions painted;
+                painted.fusedColorize = false;
+
+                // The last round goes through the recursive Gaussian.
+                QImage expected = source.copy();
+                QImage result = source.copy();
+                QRect expectedRect;
+                QRect rect;
+                if (r < int(sizeof(radii) / sizeof(radii[0]))) {
+                    expectedRect = shadowBlur(expected, radii[r], color, painted);
+                    rect = shadowBlur(result, radii[r], color, fused);
+                } else {
+                    expectedRect = shadowBlurGaussian(expected, 6.5, color, painted);
+                    rect = shadowBlurGaussian(result, 6.5, color, fused);
+                }
+
+                if (rect != expectedRect || !sameImage(expected, result)) {
+                    printf("fused colorize: %dx%d %s, color %08x differs from QPainter\n",
+                           sizes[s][0], sizes[s][1],
+                           r < int(sizeof(radii) / sizeof(radii[0])) ? "box" : "Gaussian",
+                           color.rgba());
+                    ++mismatches;
+                }
+            }
+        }
+    }
+    printf("fused colorize: %d mismatch(es)\n", mismatches);
+    return mismatches;
+}
+
+// Every shadow of the batch atlas against shadowBlur() of the same job,
+// on its own image padded by the extent the batch rects include. Returns
+// the number of mismatches.
+static int checkBatch()
+{
+    static const int radii[] = { 0, 1, 3, 8, 16, 40 };
+    QVector<ShadowBlurJob> jobs;
+    for (int i = 0; i < 120; ++i) {
+        int width = 1 + (i * 37) % 61;
+        int height = 1 + (i * 23) % 47;
+        jobs.append(ShadowBlurJob(createRandomImage(width, height, i), radii[i % 6],
+                                  checkColors[i % (sizeof(checkColors) / sizeof(checkColors[0]))]));
+    }
+    jobs.append(ShadowBlurJob(QImage(), 4, Qt::black));
+
+    QVector<QRect> rects;
+    QImage atlas = shadowBlurBatch(jobs, &rects);
+
+    int mismatches = 0;
+    for (int i = 0; i < jobs.count(); ++i) {
+        const ShadowBlurJob& job = jobs.at(i);
+        if (job.image.isNull()) {
+            if (!rects.at(i).isNull()) {
+                printf("batch: job %d has a null image but a rect\n", i);
+                ++mismatches;
+            }
+            continue;
+        }
+
+        int extent = shadowBlurExtent(job.radius);
+        QImage expected(job.image.width() + 2 * extent, job.image.height() + 2 * extent,
+                        QImage::Format_ARGB32_Premultiplied);
+        expected.fill(0);
+        for (int y = 0; y < job.image.height(); ++y)
+            memcpy(expected.scanLine(y + extent) + extent * 4, job.image.constScanLine(y),
+                   job.image.width() * 4);
+        shadowBlur(expected, job.radius, job.color);
+
+        if (rects.at(i).size() != expected.size() || !sameImage(expected, atlas.copy(rects.at(i)))) {
+            printf("batch: job %d, %dx%d radius %d differs from shadowBlur()\n", i,
+                   job.image.width(), job.image.height(), job.radius);
+            ++mismatches;
+        }
+    }
+    printf("batch: %d mismatch(es)\n", mismatches);
+    return mismatches;
+}
+
+// Runs every supported instruction set, on one thread and split across
+// the pool, against the scalar kernels. The results have to be identical
+// to the bit, then the fused colorize and the batch have to match the
+// plain shadowBlur(). Returns the number of mismatches.
+static int runCheck()
+{
+    static const int widths[] = { 1, 7, 15, 16, 17, 31, 33, 100, 257 };
+    static const int heights[] = { 1, 9, 64, 131 };
+    static const int radii[] = { 1, 2, 5, 16, 64, 128 };
+    static const ShadowBlurInstructionSet instructionSets[] = {
+        ShadowBlurSSE2, ShadowBlurAVX2, ShadowBlurNEON
+    };
+    static const char* const names[] = { "SSE2", "AVX2", "NEON" };
+
+    int failures = 0;
+    int cases = 0;
+    for (unsigned s = 0; s < sizeof(instructionSets) / sizeof(instructionSets[0]); ++s) {
+        if (!shadowBlurSupports(instructionSets[s])) {
+            printf("%s: not supported, skipped\n", names[s]);
+            continue;
+        }
+        int mismatches = 0;
+        for (unsigned w = 0; w < sizeof(widths) / sizeof(widths[0]); ++w) {
+            for (unsigned h = 0; h < sizeof(heights) / sizeof(heights[0]); ++h) {
+                QImage source = createRandomImage(widths[w], heights[h], widths[w] * 1000 + heights[h]);
+                QImage sourceMask = alphaMask(source);
+                for (unsigned r = 0; r < sizeof(radii) / sizeof(radii[0]); ++r) {
+                    ShadowBlurOptions scalar;
+                    scalar.instructionSet = ShadowBlurScalar;
+                    scalar.threadCount = 1;
+                    QImage reference = source.copy();
+                    QRect referenceRect = shadowBlur(reference, radii[r], QColor(0, 0, 0, 160), scalar);
+                    QImage referenceMask = sourceMask.copy();
+                    QRect referenceMaskRect = shadowBlurAlpha(referenceMask, radii[r], scalar);
+
+                    for (int threads = 1; threads >= 0; --threads) {
+                        ShadowBlurOptions options;
+                        options.instructionSet = instructionSets[s];
+                        options.threadCount = threads;
+                        options.threadThreshold = 0;
+
+                        QImage result = source.copy();
+                        QRect rect = shadowBlur(result, radii[r], QColor(0, 0, 0, 160), options);
+                        QImage mask = sourceMask.copy();
+                        QRect maskRect = shadowBlurAlpha(mask, radii[r], options);
+
+                        ++cases;
+                        if (rect != referenceRect || !sameImage(reference, result)
+                            || maskRect != referenceMaskRect || !sameImage(referenceMask, mask)) {
+                            printf("%s: %dx%d radius %d, %s differs from the scalar result\n",
+                                   names[s], widths[w], heights[h], radii[r],
+                                   threads ? "single-threaded" : "threaded");
+                            ++mismatches;
+                        }
+                    }
+                }
+            }
+        }
+        printf("%s: %d mismatch(es)\n", names[s], mismatches);
+        failures += mismatches;
+    }
+
+    printf("\n%d case(s) checked, %d mismatch(es)\n\n", cases, failures);
+
+    failures += checkFusedColorize();
+    failures += checkBatch();
+    return failures;
+}
+
+// The shadow of a filled rect of the given size, blurred in full and
+// through the nine-patch of drawRectShadow(), with the same margin.
+static QImage blurredRectShadow(const QSize& size, int radius, const QColor& color)
+{
+    int margin = shadowBlurExtent(radius) + 1;
+    QImage image(size.width() + 2 * margin, size.height() + 2 * margin,
+                 QImage::Format_ARGB32_Premultiplied);
+    image.fill(0);
+    QPainter p(&image);
+    p.fillRect(QRect(QPoint(margin, margin), size), Qt::black);
+    p.end();
+    shadowBlur(image, radius, color);
+    return image;
+}
+
+static QImage ninePatchRectShadow(const QSize& size, int radius, const QColor& color, ShadowCache* cache)
+{
+    int margin = shadowBlurExtent(radius) + 1;
+    QImage image(size.width() + 2 * margin, size.height() + 2 * margin,
+                 QImage::Format_ARGB32_Premultiplied);
+    image.fill(0);
+    QPainter p(&image);
+    drawRectShadow(&p, QRect(QPoint(margin, margin), size), 0, radius, color, cache);
+    p.end();
+    return image;
+}
+
+struct BlurredRectShadow
+{
+    QSize size;
+    int radius;
+    void operator()() const { blurredRectShadow(size, radius, Qt::black); }
+};
+
+struct NinePatchRectShadow
+{
+    QSize size;
+    int radius;
+    ShadowCache* cache;
+    void operator()() const { ninePatchRectShadow(size, radius, Qt::black, cache); }
+};
+
+// drawRectShadow() against shadowBlur() of the same filled rect. For a
+// sharp rect the nine-patch has to give the very same pixels, at a cost
+// which does not depend on the size. Returns the number of mismatches.
+static int runRectShadow(const Settings& settings)
+{
+    QSize size(settings.height, qMax(1, settings.height * 3 / 4));
+    ShadowCache cache;
+    int failures = 0;
+
+    printf("Shadow of a %dx%d rect, best of %d runs, nine-patch with a warm cache\n\n",
+           size.width(), size.height(), settings.repeat);
+    printf("%8s %10s %10s %12s %12s %10s\n", "radius", "max error", "mean error", "shadowBlur",
+           "nine-patch", "speedup");
+
+    static const int radii[] = { 1, 2, 4, 8, 16, 32, 64, 128 };
+    for (unsigned i = 0; i < sizeof(radii) / sizeof(radii[0]); ++i) {
+        QColor color(0, 0, 0, 160);
+        AlphaError error = alphaError(blurredRectShadow(size, radii[i], color),
+                                      ninePatchRectShadow(size, radii[i], color, 0));
+        bool failed = error.max > 0;
+        failures += failed;
+
+        BlurredRectShadow blurred = { size, radii[i] };
+        NinePatchRectShadow ninePatch = { size, radii[i], &cache };
+        ninePatch();
+        qint64 blurredTime = measure(blurred, settings.repeat);
+        qint64 ninePatchTime = measure(ninePatch, settings.repeat);
+        printf("%8d %10d %10.3f %9.3f ms %9.3f ms %9.2fx%s\n", radii[i], error.max, error.mean,
+               blurredTime / 1e6, ninePatchTime / 1e6,
+               (ninePatchTime > 0) ? double(blurredTime) / ninePatchTime : 0.0,
+               failed ? "  FAILED" : "");
+    }
+
+    printf("\n%d radius(es) where the nine-patch differs from shadowBlur()\n", failures);
+    return failures;
+}
+
+// What a compositor does every frame: a few hundred small layers, with
+// a handful of different radii.
+static void runBatch(const Settings& settings)
+{
+    static const int radii[] = { 4, 8, 16 };
+    QVector<ShadowBlurJob> jobs;
+    for (int i = 0; i < 300; ++i) {
+        int size = 24 + (i % 5) * 8;
+        jobs.append(ShadowBlurJob(createShapeImage(size), radii[i % 3], QColor(0, 0, 0, 128)));
+    }
+
+    SingleShadows single = { jobs };
+    BatchShadows batch = { jobs };
+    qint64 singleTime = measure(single, settings.repeat);
+    qint64 batchTime = measure(batch, settings.repeat);
+
+    printf("%d layers, best of %d runs\n\n", jobs.count(), settings.repeat);
+    printf("%12s %10.3f ms\n", "shadowBlur", singleTime / 1e6);
+    printf("%12s %10.3f ms %9.2fx\n", "batch", batchTime / 1e6,
+           (batchTime > 0) ? double(singleTime) / batchTime : 0.0);
+}
+
+int main(int argc, char *argv[])
+{
+    Settings settings;
+    settings.warmup = 2;
+    settings.repeat = 10;
+    settings.height = 1024;
+    settings.radius = 16;
+    settings.threshold = 10;
+
+    QStringList args;
+    for (int i = 1; i < argc; ++i)
+        args << QString::fromLocal8Bit(argv[i]);
+    for (int i = 0; i < args.count() - 1; ++i) {
+        if (args.at(i) == "--warmup")
+            settings.warmup = qMax(0, args.at(i + 1).toInt());
+        if (args.at(i) == "--repeat")
+            settings.repeat = qMax(1, args.at(i + 1).toInt());
+        if (args.at(i) == "--height")
+            settings.height = qMax(1, args.at(i + 1).toInt());
+        if (args.at(i) == "--radius")
+            settings.radius = qBound(0, args.at(i + 1).toInt(), 128);
+        if (args.at(i) == "--threshold")
+            settings.threshold = args.at(i + 1).toDouble();
+        if (args.at(i) == "--save")
+            settings.saveFile = args.at(i + 1);
+        if (args.at(i) == "--compare")
+            settings.compareFile = args.at(i + 1);
+    }
+
+    if (args.contains("--passes")) {
+        runPasses(settings);
+        return 0;
+    }
+    if (args.contains("--accuracy"))
+        return runAccuracy(settings) > 0 ? 1 : 0;
+    if (args.contains("--rect"))
+        return runRectShadow(settings) > 0 ? 1 : 0;
+    if (args.contains("--check"))
+        return runCheck() > 0 ? 1 : 0;
+    if (args.contains("--batch")) {
+        runBatch(settings);
+        return 0;
+    }
+    return runSuite(settings);
+}
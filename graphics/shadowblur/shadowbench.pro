@@ -0,0 +1,6 @@
+TARGET = shadowbench
+CONFIG += console
+CONFIG -= app_bundle
+SOURCES = shadowbench.cpp shadowblur.cpp shadowcache.cpp rectshadow.cpp shadowbatch.cpp shadowstream.cpp
+SOURCES += shadowblur_sse2.cpp shadowblur_avx2.cpp shadowblur_neon.cpp
+HEADERS = shadowblur.h shadowblur_p.h shadowcache.h rectshadow.h shadowbatch.h shadowstream.h
@@ -28,87 +28,964 @@
 */
 
 #include "shadowblur.h"
+#include "shadowblur_p.h"
 
+#include <QAtomicInt>
 #include <QImage>
+#include <QPaintDevice>
 #include <QPainter>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QSharedPointer>
+#include <QThread>
+#include <QThreadPool>
+#include <QVector>
 
-static const int BlurSumShift = 15;
+#include <math.h>
 
 // Check http://www.w3.org/TR/SVG/filters.html#feGaussianBlur.
 // As noted in the SVG filter specification, running box blur 3x
 // approximates a real gaussian blur nicely.
 
-void shadowBlur(QImage& image, int radius, const QColor& shadowColor)
+BoxBlurKernel boxBlurKernel(int radius)
 {
-    // See comments in http://webkit.org/b/40793, it seems sensible
-    // to follow Skia's limit of 128 pixels for the blur radius.
-    if (radius > 128)
-        radius = 128;
-
-    int channels[4] = { 3, 0, 1, 3 };
     int dmax = radius >> 1;
     int dmin = dmax - 1 + (radius & 1);
     if (dmin < 0)
         dmin = 0;
 
-    // Two stages: horizontal and vertical
+    BoxBlurKernel kernel;
+    for (int step = 0; step < 3; ++step) {
+        kernel.side1[step] = (step == 0) ? dmin : dmax;
+        kernel.side2[step] = (step == 1) ? dmin : dmax;
+        int pixelCount = kernel.side1[step] + 1 + kernel.side2[step];
+        kernel.invCount[step] = ((1 << BlurSumShift) + pixelCount - 1) / pixelCount;
+    }
+    return kernel;
+}
+
+// One box pass over a single lane. We use sliding window algorithm to
+// accumulate the alpha values. This is much more efficient than computing
+// the sum of each pixels covered by the box kernel size for each x.
+// This is the reference implementation, the SIMD kernels must produce
+// exactly the same result.
+static void boxBlurStep(const uchar *src, uchar *dst, int stride, int dim,
+                        int side1, int side2, int invCount)
+{
+    int ofs = 1 + side2;
+    int alpha1 = src[0];
+    int alpha2 = src[(dim - 1) * stride];
+    uchar* ptr = dst;
+    const uchar* prev = src + stride;
+    const uchar* next = src + ofs * stride;
+
+    int i;
+    int sum = side1 * alpha1 + alpha1;
+    int limit = (dim < side2 + 1) ? dim : side2 + 1;
+    for (i = 1; i < limit; ++i, prev += stride)
+        sum += *prev;
+    if (limit <= side2)
+        sum += (side2 - limit + 1) * alpha2;
+
+    limit = (side1 < dim) ? side1 : dim;
+    for (i = 0; i < limit; ptr += stride, next += stride, ++i, ++ofs) {
+        *ptr = (sum * invCount) >> BlurSumShift;
+        sum += ((ofs < dim) ? *next : alpha2) - alpha1;
+    }
+    prev = src;
+    for (; ofs < dim; ptr += stride, prev += stride, next += stride, ++i, ++ofs) {
+        *ptr = (sum * invCount) >> BlurSumShift;
+        sum += (*next) - (*prev);
+    }
+    for (; i < dim; ptr += stride, prev += stride, ++i) {
+        *ptr = (sum * invCount) >> BlurSumShift;
+        sum += alpha2 - (*prev);
+    }
+}
+
+void boxBlurLanes(uchar *src, uchar *dst, int stride, int lanes, int dim, const BoxBlurKernel &kernel)
+{
+    // The three passes ping-pong between both buffers, the last one
+    // ends up in dst.
+    for (int l = 0; l < lanes; ++l) {
+        boxBlurStep(src + l, dst + l, stride, dim,
+                    kernel.side1[0], kernel.side2[0], kernel.invCount[0]);
+        boxBlurStep(dst + l, src + l, stride, dim,
+                    kernel.side1[1], kernel.side2[1], kernel.invCount[1]);
+        boxBlurStep(src + l, dst + l, stride, dim,
+                    kernel.side1[2], kernel.side2[2], kernel.invCount[2]);
+    }
+}
+
+// The three passes together reach side1 (resp. side2) pixels of every
+// pass away from the current pixel.
+int shadowBlurExtent(int radius)
+{
+    BoxBlurKernel kernel = boxBlurKernel(qBound(0, radius, 128));
+    return qMax(kernel.side1[0] + kernel.side1[1] + kernel.side1[2],
+                kernel.side2[0] + kernel.side2[1] + kernel.side2[2]);
+}
+
+// Young and van Vliet, "Recursive implementation of the Gaussian filter",
+// Signal Processing 44 (1995). The coefficients are polynomials of the
+// single parameter q.
+static void gaussianCoefficients(qreal q, qreal *b, qreal *a)
+{
+    qreal q2 = q * q;
+    qreal q3 = q2 * q;
+    qreal b0 = 1.57825 + 2.44413 * q + 1.4281 * q2 + 0.422205 * q3;
+    a[0] = (2.44413 * q + 2.85619 * q2 + 1.26661 * q3) / b0;
+    a[1] = -(1.4281 * q2 + 1.26661 * q3) / b0;
+    a[2] = 0.422205 * q3 / b0;
+    *b = 1 - a[0] - a[1] - a[2];
+}
+
+// The forward and backward passes together have twice the variance of
+// the forward one, whose impulse response is b / (1 - a1 z^-1 - a2 z^-2
+// - a3 z^-3). Its first two moments follow from the derivatives at z = 1.
+static qreal gaussianVariance(qreal q)
+{
+    qreal b;
+    qreal a[3];
+    gaussianCoefficients(q, &b, a);
+    qreal mean = (a[0] + 2 * a[1] + 3 * a[2]) / b;
+    return 2 * ((a[0] + 4 * a[1] + 9 * a[2]) / b + mean * mean);
+}
+
+// The closed form q(sigma) from the paper gives a variance several
+// percent too large. Instead q is solved for, by bisection, so that the
+// variance is exactly sigma^2. The cost per pixel does not depend on it.
+GaussianKernel gaussianKernel(qreal sigma)
+{
+    qreal low = 0;
+    qreal high = 2 * sigma + 2;
+    for (int i = 0; i < 48; ++i) {
+        qreal q = (low + high) / 2;
+        if (gaussianVariance(q) < sigma * sigma)
+            low = q;
+        else
+            high = q;
+    }
+
+    qreal b;
+    qreal a[3];
+    gaussianCoefficients((low + high) / 2, &b, a);
+
+    GaussianKernel kernel;
+    kernel.b = b;
+    kernel.a[0] = a[0];
+    kernel.a[1] = a[1];
+    kernel.a[2] = a[2];
+    return kernel;
+}
+
+// A causal pass into scratch followed by an anti-causal pass into dst.
+// Both start in the steady state of a constant signal, i.e. the edge
+// pixels are repeated, like the box passes do. All the lanes advance
+// together so that the inner loop is easy to vectorize.
+void gaussianBlurLanes(const uchar *src, uchar *dst, float *scratch, int stride, int lanes, int dim,
+                       const GaussianKernel &kernel)
+{
+    Q_ASSERT(lanes <= BlurLaneGroup);
+
+    const float b = kernel.b;
+    const float a1 = kernel.a[0];
+    const float a2 = kernel.a[1];
+    const float a3 = kernel.a[2];
+    float h1[BlurLaneGroup], h2[BlurLaneGroup], h3[BlurLaneGroup];
+
+    for (int l = 0; l < lanes; ++l)
+        h1[l] = h2[l] = h3[l] = src[l];
+    for (int i = 0; i < dim; ++i) {
+        const uchar* p = src + i * stride;
+        float* w = scratch + i * stride;
+        for (int l = 0; l < lanes; ++l) {
+            float v = b * p[l] + a1 * h1[l] + a2 * h2[l] + a3 * h3[l];
+            h3[l] = h2[l];
+            h2[l] = h1[l];
+            h1[l] = v;
+            w[l] = v;
+        }
+    }
+
+    for (int l = 0; l < lanes; ++l)
+        h1[l] = h2[l] = h3[l] = scratch[(dim - 1) * stride + l];
+    for (int i = dim - 1; i >= 0; --i) {
+        const float* w = scratch + i * stride;
+        uchar* q = dst + i * stride;
+        for (int l = 0; l < lanes; ++l) {
+            float v = b * w[l] + a1 * h1[l] + a2 * h2[l] + a3 * h3[l];
+            h3[l] = h2[l];
+            h2[l] = h1[l];
+            h1[l] = v;
+            q[l] = qBound(0, int(v + 0.5f), 255);
+        }
+    }
+}
+
+// The recursive filter has longer tails than a true Gaussian, what is left
+// of a fully opaque edge only rounds to zero beyond about 4.6 sigmas.
+int shadowBlurGaussianExtent(qreal sigma)
+{
+    return int(ceil(5 * qBound(qreal(0), sigma, ShadowBlurMaxSigma)));
+}
+
+// The standard deviation of the three box passes, see the definition
+// of the box size d in the SVG specification.
+qreal shadowBlurSigma(int radius)
+{
+    return qBound(0, radius, 128) * 4 / (3 * sqrt(2 * M_PI));
+}
+
+ShadowBlurOptions::ShadowBlurOptions()
+    : instructionSet(ShadowBlurAutoDetect)
+    , columnBlock(BlurColumnBlock)
+    , threadCount(0)
+    , threadThreshold(256 * 256)
+    , downsampleRadius(0)
+    , fusedColorize(true)
+{
+}
+
+static ShadowBlurInstructionSet detectInstructionSet()
+{
+#if defined(SHADOWBLUR_HAVE_AVX2)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return ShadowBlurAVX2;
+#endif
+#if defined(SHADOWBLUR_HAVE_SSE2)
+    return ShadowBlurSSE2;
+#elif defined(SHADOWBLUR_HAVE_NEON)
+    return ShadowBlurNEON;
+#else
+    return ShadowBlurScalar;
+#endif
+}
+
+bool shadowBlurSupports(ShadowBlurInstructionSet instructionSet)
+{
+    static const ShadowBlurInstructionSet best = detectInstructionSet();
+
+    switch (instructionSet) {
+    case ShadowBlurAutoDetect:
+    case ShadowBlurScalar:
+        return true;
+    case ShadowBlurSSE2:
+        return best == ShadowBlurSSE2 || best == ShadowBlurAVX2;
+    case ShadowBlurAVX2:
+    case ShadowBlurNEON:
+        return best == instructionSet;
+    }
+    return false;
+}
+
+ShadowBlurInstructionSet shadowBlurInstructionSet(const ShadowBlurOptions& options)
+{
+    static const ShadowBlurInstructionSet best = detectInstructionSet();
+
+    // Silently fall back to the best available kernel if the requested
+    // one can not run here.
+    if (options.instructionSet == ShadowBlurAutoDetect || !shadowBlurSupports(options.instructionSet))
+        return best;
+    return options.instructionSet;
+}
+
+BoxBlurLanesFunction boxBlurLanesFunction(ShadowBlurInstructionSet instructionSet)
+{
+    switch (instructionSet) {
+#ifdef SHADOWBLUR_HAVE_SSE2
+    case ShadowBlurSSE2:
+        return boxBlurLanes_sse2;
+#endif
+#ifdef SHADOWBLUR_HAVE_AVX2
+    case ShadowBlurAVX2:
+        return boxBlurLanes_avx2;
+#endif
+#ifdef SHADOWBLUR_HAVE_NEON
+    case ShadowBlurNEON:
+        return boxBlurLanes_neon;
+#endif
+    default:
+        break;
+    }
+    return boxBlurLanes;
+}
+
+QRect shadowBlur(QImage& image, int radius, const QColor& shadowColor)
+{
+    return shadowBlur(image, radius, shadowColor, ShadowBlurOptions());
+}
+
+// What runs on the gathered lanes: the box passes, using the kernel
+// selected for the CPU, or the recursive Gaussian which needs a float
+// scratch buffer of the size of a lane group.
+struct BoxLaneBlur
+{
+    BoxBlurKernel kernel;
+    BoxBlurLanesFunction blurLanes;
+
+    int scratchSize(int) const { return 0; }
+    void operator()(uchar *src, uchar *dst, float *, int stride, int lanes, int dim) const
+    {
+        blurLanes(src, dst, stride, lanes, dim, kernel);
+    }
+};
+
+struct GaussianLaneBlur
+{
+    GaussianKernel kernel;
+
+    int scratchSize(int dim) const { return BlurLaneGroup * dim; }
+    void operator()(uchar *src, uchar *dst, float *scratch, int stride, int lanes, int dim) const
+    {
+        gaussianBlurLanes(src, dst, scratch, stride, lanes, dim, kernel);
+    }
+};
+
+// Rows are gathered BlurLaneGroup at a time, so that the same pixel of
+// every row sits next to each other. The SIMD kernels then blur all the
+// rows in one go.
+template <typename LaneBlur>
+static void blurRows(const AlphaPlane &plane, const LaneBlur &blur)
+{
+    int dim = plane.width;
+    QVector<uchar> buffer(2 * BlurLaneGroup * dim);
+    QVector<float> scratch(blur.scratchSize(dim));
+    uchar* src = buffer.data();
+    uchar* dst = src + BlurLaneGroup * dim;
+
+    for (int j = 0; j < plane.height; j += BlurLaneGroup) {
+        int lanes = qMin(BlurLaneGroup, plane.height - j);
+        uchar* pixels = plane.bits + j * plane.bytesPerLine;
+
+        for (int l = 0; l < lanes; ++l) {
+            const uchar* p = pixels + l * plane.bytesPerLine;
+            uchar* q = src + l;
+            for (int i = 0; i < dim; ++i, p += plane.pixelStride, q += BlurLaneGroup)
+                *q = *p;
+        }
+
+        blur(src, dst, scratch.data(), BlurLaneGroup, lanes, dim);
+
+        for (int l = 0; l < lanes; ++l) {
+            uchar* p = pixels + l * plane.bytesPerLine;
+            const uchar* q = dst + l;
+            for (int i = 0; i < dim; ++i, p += plane.pixelStride, q += BlurLaneGroup)
+                *p = *q;
+        }
+    }
+}
+
+// Walking down a column touches a different cache line (and often a
+// different page) for every pixel. Instead, a block of blockWidth columns
+// is transposed into the scratch buffer in one sweep over the rows, each
+// row contributing a few consecutive cache lines. Every lane group of the
+// block is stored contiguously, so that the blur itself runs over the same
+// dense layout as the horizontal pass.
+template <typename LaneBlur>
+static void blurColumns(const AlphaPlane &plane, const LaneBlur &blur, int blockWidth)
+{
+    blockWidth = (qMax(blockWidth, 1) + BlurLaneGroup - 1) / BlurLaneGroup * BlurLaneGroup;
+
+    int dim = plane.height;
+    int groupSize = BlurLaneGroup * dim;
+    QVector<uchar> buffer(2 * blockWidth * dim);
+    QVector<float> scratch(blur.scratchSize(dim));
+    uchar* src = buffer.data();
+    uchar* dst = src + blockWidth * dim;
+
+    for (int j = 0; j < plane.width; j += blockWidth) {
+        int columns = qMin(blockWidth, plane.width - j);
+        uchar* pixels = plane.bits + j * plane.pixelStride;
+
+        for (int i = 0; i < dim; ++i) {
+            const uchar* p = pixels + i * plane.bytesPerLine;
+            uchar* q = src + i * BlurLaneGroup;
+            for (int l = 0; l < columns; q += groupSize - BlurLaneGroup) {
+                int lanes = qMin(BlurLaneGroup, columns - l);
+                for (int n = 0; n < lanes; ++n, ++l, p += plane.pixelStride)
+                    *q++ = *p;
+            }
+        }
+
+        for (int l = 0, g = 0; l < columns; l += BlurLaneGroup, g += groupSize)
+            blur(src + g, dst + g, scratch.data(), BlurLaneGroup, qMin(BlurLaneGroup, columns - l), dim);
+
+        for (int i = 0; i < dim; ++i) {
+            uchar* p = pixels + i * plane.bytesPerLine;
+            const uchar* q = dst + i * BlurLaneGroup;
+            for (int l = 0; l < columns; q += groupSize - BlurLaneGroup) {
+                int lanes = qMin(BlurLaneGroup, columns - l);
+                for (int n = 0; n < lanes; ++n, ++l, p += plane.pixelStride)
+                    storeAlpha(p, *q++, plane.colorTable);
+            }
+        }
+    }
+}
+
+void blurHorizontal(const AlphaPlane &plane, const BoxBlurKernel &kernel, BoxBlurLanesFunction blurLanes)
+{
+    BoxLaneBlur blur = { kernel, blurLanes };
+    blurRows(plane, blur);
+}
+
+void blurVertical(const AlphaPlane &plane, const BoxBlurKernel &kernel, BoxBlurLanesFunction blurLanes,
+                  int blockWidth)
+{
+    BoxLaneBlur blur = { kernel, blurLanes };
+    blurColumns(plane, blur, blockWidth);
+}
+
+// Shared between the calling thread and the pool workers. Chunks are
+// claimed through the atomic counter, thus a worker which starts late (or
+// never, e.g. when the pool is busy) does not hold up the caller: it will
+// simply find nothing left to do.
+struct ParallelState
+{
+    ParallelState(ParallelTask *t, int n) : task(t), count(n), next(0) { }
+
+    bool runNext()
+    {
+        int index = next.fetchAndAddOrdered(1);
+        if (index >= count)
+            return false;
+        task->run(index);
+        done.release();
+        return true;
+    }
+
+    ParallelTask* task;
+    int count;
+    QAtomicInt next;
+    QSemaphore done;
+};
+
+class ParallelWorker: public QRunnable
+{
+public:
+    ParallelWorker(const QSharedPointer<ParallelState> &state) : m_state(state) { }
+    void run() { while (m_state->runNext()) { } }
+
+private:
+    QSharedPointer<ParallelState> m_state;
+};
+
+void runParallel(ParallelTask *task, int count, int threadCount)
+{
+    if (threadCount <= 0)
+        threadCount = QThread::idealThreadCount();
+    threadCount = qMin(threadCount, count);
+
+    if (threadCount <= 1) {
+        for (int i = 0; i < count; ++i)
+            task->run(i);
+        return;
+    }
+
+    QSharedPointer<ParallelState> state(new ParallelState(task, count));
+    for (int i = 1; i < threadCount; ++i)
+        QThreadPool::globalInstance()->start(new ParallelWorker(state));
+
+    // The calling thread works too, then waits for the chunks which are
+    // still being processed by the workers.
+    while (state->runNext()) { }
+    state->done.acquire(count);
+}
+
+template <typename LaneBlur>
+class BlurPassTask: public ParallelTask
+{
+public:
+    AlphaPlane plane;
+    LaneBlur blur;
+    int blockWidth;
+    int chunkSize;
+    bool vertical;
+
+    void run(int index)
+    {
+        AlphaPlane chunk = plane;
+        int first = index * chunkSize;
+        if (vertical) {
+            chunk.bits += first * plane.pixelStride;
+            chunk.width = qMin(chunkSize, plane.width - first);
+            blurColumns(chunk, blur, qMin(blockWidth, chunkSize));
+        } else {
+            chunk.bits += first * plane.bytesPerLine;
+            chunk.height = qMin(chunkSize, plane.height - first);
+            blurRows(chunk, blur);
+        }
+    }
+};
+
+// Rows of the horizontal pass and columns of the vertical pass are
+// independent, thus both passes are split into chunks of lines which
+// are spread across the thread pool. runParallel() only returns once
+// every chunk is done, which is the barrier between both passes.
+template <typename LaneBlur>
+static void blurPlane(const AlphaPlane &plane, const LaneBlur &blur, const ShadowBlurOptions &options)
+{
+    BlurPassTask<LaneBlur> task;
+    task.plane = plane;
+    task.blur = blur;
+    task.blockWidth = options.columnBlock;
+
+    int threadCount = options.threadCount;
+    if (threadCount <= 0)
+        threadCount = QThread::idealThreadCount();
+    if (qint64(plane.width) * plane.height < options.threadThreshold)
+        threadCount = 1;
+
+    // A few chunks per thread to even out the load, each one a whole
+    // number of lane groups.
     for (int k = 0; k < 2; ++k) {
+        task.vertical = (k == 1);
+        int lines = task.vertical ? plane.width : plane.height;
+        int chunks = (threadCount > 1) ? threadCount * 4 : 1;
+        int chunkSize = (lines + chunks - 1) / chunks;
+        task.chunkSize = (chunkSize + BlurLaneGroup - 1) / BlurLaneGroup * BlurLaneGroup;
+        runParallel(&task, (lines + task.chunkSize - 1) / task.chunkSize, threadCount);
+    }
+}
 
-        unsigned char* pixels = image.bits();
-        int stride = (k == 0) ? 4 : image.bytesPerLine();
-        int delta = (k == 0) ? image.bytesPerLine() : 4;
-        int jfinal = (k == 0) ? image.height() : image.width();
-        int dim = (k == 0) ? image.width() : image.height();
-
-        for (int j = 0; j < jfinal; ++j, pixels += delta) {
-
-            // For each step, we blur the alpha in a channel and store the result
-            // in another channel for the subsequent step.
-            // We use sliding window algorithm to accumulate the alpha values.
-            // This is much more efficient than computing the sum of each pixels
-            // covered by the box kernel size for each x.
-
-            for (int step = 0; step < 3; ++step) {
-                int side1 = (step == 0) ? dmin : dmax;
-                int side2 = (step == 1) ? dmin : dmax;
-                int pixelCount = side1 + 1 + side2;
-                int invCount = ((1 << BlurSumShift) + pixelCount - 1) / pixelCount;
-                int ofs = 1 + side2;
-                int alpha1 = pixels[channels[step]];
-                int alpha2 = pixels[(dim - 1) * stride + channels[step]];
-                unsigned char* ptr = pixels + channels[step + 1];
-                unsigned char* prev = pixels + stride + channels[step];
-                unsigned char* next = pixels + ofs * stride + channels[step];
-
-                int i;
-                int sum = side1 * alpha1 + alpha1;
-                int limit = (dim < side2 + 1) ? dim : side2 + 1;
-                for (i = 1; i < limit; ++i, prev += stride)
-                    sum += *prev;
-                if (limit <= side2)
-                    sum += (side2 - limit + 1) * alpha2;
-
-                limit = (side1 < dim) ? side1 : dim;
-                for (i = 0; i < limit; ptr += stride, next += stride, ++i, ++ofs) {
-                    *ptr = (sum * invCount) >> BlurSumShift;
-                    sum += ((ofs < dim) ? *next : alpha2) - alpha1;
-                }
-                prev = pixels + channels[step];
-                for (; ofs < dim; ptr += stride, prev += stride, next += stride, ++i, ++ofs) {
-                    *ptr = (sum * invCount) >> BlurSumShift;
-                    sum += (*next) - (*prev);
-                }
-                for (; i < dim; ptr += stride, prev += stride, ++i) {
-                    *ptr = (sum * invCount) >> BlurSumShift;
-                    sum += alpha2 - (*prev);
+void blurAlphaPlane(const AlphaPlane &plane, int radius, const ShadowBlurOptions &options)
+{
+    BoxLaneBlur blur;
+    blur.kernel = boxBlurKernel(radius);
+    blur.blurLanes = boxBlurLanesFunction(shadowBlurInstructionSet(options));
+    blurPlane(plane, blur, options);
+}
+
+void blurAlphaPlaneGaussian(const AlphaPlane &plane, qreal sigma, const ShadowBlurOptions &options)
+{
+    GaussianLaneBlur blur;
+    blur.kernel = gaussianKernel(sigma);
+    blurPlane(plane, blur, options);
+}
+
+// Box average of every factor x factor block, partial blocks at the
+// right and bottom edges only average the pixels they cover.
+static void downsampleAlpha(const AlphaPlane &src, const AlphaPlane &dst, int factor)
+{
+    for (int y = 0; y < dst.height; ++y) {
+        int y1 = y * factor;
+        int y2 = qMin(y1 + factor, src.height);
+        uchar* q = dst.bits + y * dst.bytesPerLine;
+        for (int x = 0; x < dst.width; ++x, q += dst.pixelStride) {
+            int x1 = x * factor;
+            int x2 = qMin(x1 + factor, src.width);
+            int sum = 0;
+            for (int sy = y1; sy < y2; ++sy) {
+                const uchar* p = src.bits + sy * src.bytesPerLine + x1 * src.pixelStride;
+                for (int sx = x1; sx < x2; ++sx, p += src.pixelStride)
+                    sum += *p;
+            }
+            int count = (y2 - y1) * (x2 - x1);
+            *q = (sum + count / 2) / count;
+        }
+    }
+}
+
+// Maps the center of every destination pixel back into the source, as
+// 24.8 fixed point, and returns the two source pixels to interpolate
+// together with the weight of the second one.
+static void bilinearSamples(int dim, int srcDim, int factor, QVector<int> &first, QVector<int> &weight)
+{
+    first.resize(dim);
+    weight.resize(dim);
+    for (int i = 0; i < dim; ++i) {
+        int pos = (2 * i + 1) * 128 / factor - 128;
+        if (pos < 0)
+            pos = 0;
+        int index = pos >> 8;
+        if (index >= srcDim - 1) {
+            first[i] = srcDim - 1;
+            weight[i] = 0;
+        } else {
+            first[i] = index;
+            weight[i] = pos & 255;
+        }
+    }
+}
+
+// Separable: every source row is interpolated horizontally once (it is
+// shared by up to 2 * factor destination rows), then each destination row
+// is a simple blend of two such rows.
+static void upsampleAlpha(const AlphaPlane &src, const AlphaPlane &dst, int factor)
+{
+    QVector<int> sx, wx, sy, wy;
+    bilinearSamples(dst.width, src.width, factor, sx, wx);
+    bilinearSamples(dst.height, src.height, factor, sy, wy);
+
+    QVector<int> rows(2 * dst.width);
+    int* upper = rows.data();
+    int* lower = upper + dst.width;
+    int upperRow = -1;
+    int lowerRow = -1;
+
+    for (int y = 0; y < dst.height; ++y) {
+        int row = sy[y];
+        if (row != upperRow) {
+            if (row == lowerRow) {
+                qSwap(upper, lower);
+                lowerRow = upperRow;
+            } else {
+                const uchar* p = src.bits + row * src.bytesPerLine;
+                for (int x = 0; x < dst.width; ++x) {
+                    const uchar* s = p + sx[x] * src.pixelStride;
+                    upper[x] = (s[0] << 8) + (s[wx[x] ? src.pixelStride : 0] - s[0]) * wx[x];
                 }
             }
+            upperRow = row;
+        }
+        int w = wy[y];
+        if (w > 0 && lowerRow != row + 1) {
+            const uchar* p = src.bits + (row + 1) * src.bytesPerLine;
+            for (int x = 0; x < dst.width; ++x) {
+                const uchar* s = p + sx[x] * src.pixelStride;
+                lower[x] = (s[0] << 8) + (s[wx[x] ? src.pixelStride : 0] - s[0]) * wx[x];
+            }
+            lowerRow = row + 1;
         }
+
+        uchar* q = dst.bits + y * dst.bytesPerLine;
+        if (w == 0) {
+            for (int x = 0; x < dst.width; ++x, q += dst.pixelStride)
+                storeAlpha(q, (upper[x] + 128) >> 8, dst.colorTable);
+        } else {
+            for (int x = 0; x < dst.width; ++x, q += dst.pixelStride)
+                storeAlpha(q, ((upper[x] << 8) + (lower[x] - upper[x]) * w + 32768) >> 16, dst.colorTable);
+        }
+    }
+}
+
+// A large blur radius removes the high frequencies anyway, thus the blur
+// can run on a 2x or 4x smaller copy of the alpha plane, at a quarter or
+// a sixteenth of the cost. The factor is the largest one which keeps the
+// reduced radius at or above the caller's quality threshold.
+static int downsampleFactor(int radius, const ShadowBlurOptions &options)
+{
+    if (options.downsampleRadius <= 0)
+        return 1;
+    int factor = 1;
+    while (factor < 4 && radius / (factor * 2) >= options.downsampleRadius)
+        factor *= 2;
+    return factor;
+}
+
+static void blurDownsampled(const AlphaPlane &plane, int radius, int factor, const ShadowBlurOptions &options)
+{
+    AlphaPlane small;
+    small.pixelStride = 1;
+    small.width = (plane.width + factor - 1) / factor;
+    small.height = (plane.height + factor - 1) / factor;
+    small.bytesPerLine = small.width;
+    small.colorTable = 0;
+    QVector<uchar> buffer(small.width * small.height);
+    small.bits = buffer.data();
+
+    downsampleAlpha(plane, small, factor);
+    blurAlphaPlane(small, (radius + factor / 2) / factor, options);
+    upsampleAlpha(small, plane, factor);
+}
+
+QRect alphaBoundingRect(const AlphaPlane &plane)
+{
+    int top = 0;
+    int bottom = plane.height - 1;
+    int left = plane.width;
+    int right = -1;
+
+    // Fully transparent rows at the top and the bottom are skipped first,
+    // only the rows in between need to be scanned for the horizontal extent.
+    for (; top <= bottom; ++top) {
+        const uchar* p = plane.bits + top * plane.bytesPerLine;
+        int x = 0;
+        for (; x < plane.width && !p[x * plane.pixelStride]; ++x) { }
+        if (x < plane.width)
+            break;
+    }
+    if (top > bottom)
+        return QRect();
+    for (; bottom > top; --bottom) {
+        const uchar* p = plane.bits + bottom * plane.bytesPerLine;
+        int x = 0;
+        for (; x < plane.width && !p[x * plane.pixelStride]; ++x) { }
+        if (x < plane.width)
+            break;
+    }
+
+    for (int y = top; y <= bottom; ++y) {
+        const uchar* p = plane.bits + y * plane.bytesPerLine;
+        for (int x = 0; x < left; ++x) {
+            if (p[x * plane.pixelStride]) {
+                left = x;
+                break;
+            }
+        }
+        for (int x = plane.width - 1; x > right; --x) {
+            if (p[x * plane.pixelStride]) {
+                right = x;
+                break;
+            }
+        }
+    }
+
+    return QRect(QPoint(left, top), QPoint(right, bottom));
+}
+
+AlphaPlane alphaSubPlane(const AlphaPlane &plane, const QRect &rect)
+{
+    AlphaPlane sub = plane;
+    sub.bits += rect.top() * plane.bytesPerLine + rect.left() * plane.pixelStride;
+    sub.width = rect.width();
+    sub.height = rect.height();
+    return sub;
+}
+
+// Same arithmetic as BYTE_MUL and PREMUL in the raster paint engine, the
+// table thus reproduces a CompositionMode_SourceIn fill with the color.
+static inline QRgb byteMul(QRgb x, uint a)
+{
+    uint t = (x & 0xff00ff) * a;
+    t = (t + ((t >> 8) & 0xff00ff) + 0x800080) >> 8;
+    t &= 0xff00ff;
+    x = ((x >> 8) & 0xff00ff) * a;
+    x = (x + ((x >> 8) & 0xff00ff) + 0x800080);
+    x &= 0xff00ff00;
+    return x | t;
+}
+
+QVector<QRgb> premultipliedColorTable(const QColor& color)
+{
+    QRgb rgba = color.rgba();
+    QRgb premultiplied = (byteMul(rgba, qAlpha(rgba)) & 0x00ffffff) | (rgba & 0xff000000);
+
+    QVector<QRgb> table(256);
+    for (int alpha = 0; alpha < 256; ++alpha)
+        table[alpha] = byteMul(premultiplied, alpha);
+    return table;
+}
+
+static AlphaPlane imageAlphaPlane(QImage& image)
+{
+    AlphaPlane plane;
+    if (image.depth() == 8) {
+        plane.bits = image.bits();
+        plane.pixelStride = 1;
+    } else {
+        plane.bits = image.bits() + ArgbAlphaOffset;
+        plane.pixelStride = 4;
+    }
+    plane.bytesPerLine = image.bytesPerLine();
+    plane.width = image.width();
+    plane.height = image.height();
+    plane.colorTable = 0;
+    return plane;
+}
+
+// Blurs the dirty area of the plane, returns the latter. A positive sigma
+// selects the recursive Gaussian, otherwise the box passes of radius run.
+static QRect blurDirtyRect(const AlphaPlane& plane, int radius, qreal sigma, const ShadowBlurOptions& options)
+{
+    // Transparent pixels far enough from the opaque ones stay transparent,
+    // thus the blur is limited to the bounding box of the opaque pixels
+    // plus the reach of the blur. The extra pixel keeps the border of that
+    // area transparent, hence the edge clamping of the box passes gives
+    // exactly the same result as with the whole image.
+    QRect dirtyRect = alphaBoundingRect(plane);
+    if (dirtyRect.isEmpty())
+        return QRect();
+    int extent = (sigma > 0) ? shadowBlurGaussianExtent(sigma) : shadowBlurExtent(radius);
+    int margin = extent + 1;
+    dirtyRect.adjust(-margin, -margin, margin, margin);
+    dirtyRect &= QRect(0, 0, plane.width, plane.height);
+    AlphaPlane region = alphaSubPlane(plane, dirtyRect);
+
+    // Two stages: horizontal and vertical
+    if (sigma > 0) {
+        blurAlphaPlaneGaussian(region, sigma, options);
+    } else {
+        int factor = downsampleFactor(radius, options);
+        if (factor > 1)
+            blurDownsampled(region, radius, factor, options);
+        else
+            blurAlphaPlane(region, radius, options);
+    }
+
+    return dirtyRect;
+}
+
+static QVector<QRgb> shadowColorTable(const QColor& color)
+{
+    QVector<QRgb> table(256);
+    for (int alpha = 0; alpha < 256; ++alpha)
+        table[alpha] = qRgba(color.red(), color.green(), color.blue(), color.alpha() * alpha / 255);
+    return table;
+}
+
+static bool isAlphaMask(const QImage& image)
+{
+#if QT_VERSION >= 0x050500
+    if (image.format() == QImage::Format_Alpha8)
+        return true;
+#endif
+    return image.format() == QImage::Format_Indexed8;
+}
+
+static QRect blurImage(QImage& image, int radius, qreal sigma, const QColor& shadowColor,
+                       const ShadowBlurOptions& options)
+{
+    if (image.isNull())
+        return QRect();
+
+    // An 8-bit mask is blurred in place, its color table (if any) takes
+    // care of the color.
+    if (isAlphaMask(image)) {
+        AlphaPlane plane = imageAlphaPlane(image);
+        QRect dirtyRect = blurDirtyRect(plane, radius, sigma, options);
+        if (image.format() == QImage::Format_Indexed8)
+            image.setColorTable(shadowColorTable(shadowColor));
+        return dirtyRect;
+    }
+
+    // Only the alpha channel is blurred, the colors are replaced anyway.
+    AlphaPlane plane = imageAlphaPlane(image);
+
+    // With premultiplied pixels, the last pass can write the shadow color
+    // right away instead of going through QPainter afterwards.
+    QVector<QRgb> colorTable;
+    bool fused = options.fusedColorize && image.format() == QImage::Format_ARGB32_Premultiplied;
+    if (fused) {
+        colorTable = premultipliedColorTable(shadowColor);
+        plane.colorTable = colorTable.constData();
     }
 
+    QRect dirtyRect = blurDirtyRect(plane, radius, sigma, options);
+    if (dirtyRect.isEmpty() || fused)
+        return dirtyRect;
+
     // "Colorize" with the right shadow color.
     QPainter p(&image);
     p.setCompositionMode(QPainter::CompositionMode_SourceIn);
-    p.fillRect(image.rect(), shadowColor);
+    p.fillRect(dirtyRect, shadowColor);
     p.end();
+
+    return dirtyRect;
+}
+
+QRect shadowBlur(QImage& image, int radius, const QColor& shadowColor, const ShadowBlurOptions& options)
+{
+    // See comments in http://webkit.org/b/40793, it seems sensible
+    // to follow Skia's limit of 128 pixels for the blur radius.
+    if (radius > 128)
+        radius = 128;
+
+    return blurImage(image, radius, 0, shadowColor, options);
+}
+
+QRect shadowBlurGaussian(QImage& image, qreal sigma, const QColor& shadowColor, const ShadowBlurOptions& options)
+{
+    return blurImage(image, 0, qBound(qreal(0), sigma, ShadowBlurMaxSigma), shadowColor, options);
+}
+
+// 8-bit masks are taken as alpha values already, like shadowBlur() does.
+void extractAlpha(const QImage& image, uchar* dst, int bytesPerLine)
+{
+    QImage source = image;
+    bool mask = isAlphaMask(source);
+    if (!mask && (source.depth() != 32 || !source.hasAlphaChannel()))
+        source = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    int offset = mask ? 0 : ArgbAlphaOffset;
+    int pixelStride = mask ? 1 : 4;
+
+    for (int y = 0; y < source.height(); ++y) {
+        const uchar* p = source.constScanLine(y) + offset;
+        uchar* q = dst + y * bytesPerLine;
+        for (int x = 0; x < source.width(); ++x, p += pixelStride)
+            q[x] = *p;
+    }
+}
+
+QImage alphaMask(const QImage& image)
+{
+    if (isAlphaMask(image))
+        return image;
+
+    QImage mask(image.size(), QImage::Format_Indexed8);
+    if (mask.isNull())
+        return mask;
+    mask.setColorTable(shadowColorTable(Qt::black));
+    extractAlpha(image, mask.bits(), mask.bytesPerLine());
+    return mask;
+}
+
+QRect shadowBlurAlpha(QImage& mask, int radius, const ShadowBlurOptions& options)
+{
+    if (mask.isNull() || !isAlphaMask(mask))
+        return QRect();
+
+    AlphaPlane plane = imageAlphaPlane(mask);
+    return blurDirtyRect(plane, qMin(radius, 128), 0, options);
+}
+
+QImage shadowMask(const QImage& image, int radius, const QColor& color,
+                  const ShadowBlurOptions& options, QRect* dirtyRect)
+{
+    // Only a quarter of the memory is touched by the blur passes.
+    QImage mask = alphaMask(image);
+    QRect rect = shadowBlur(mask, radius, color, options);
+    if (dirtyRect)
+        *dirtyRect = rect;
+    return mask;
+}
+
+// The equivalent of a solid color fill through the mask. When painting
+// on a premultiplied image without any transformation (other than a
+// translation) or clipping, we blend directly, the way the raster engine
+// draws glyphs. Otherwise the mask is turned into a colored indexed image.
+void drawShadow(QPainter* painter, const QPoint& position, const QImage& mask,
+                const QColor& color, const QRect& sourceRect)
+{
+    QRect source = sourceRect.isNull() ? mask.rect() : (sourceRect & mask.rect());
+    if (source.isEmpty() || !isAlphaMask(mask))
+        return;
+
+    QPaintDevice* device = painter->device();
+    const QTransform& transform = painter->worldTransform();
+    bool direct = device && device->devType() == QInternal::Image &&
+                  transform.type() <= QTransform::TxTranslate &&
+                  !painter->hasClipping() && painter->opacity() == 1 &&
+                  painter->compositionMode() == QPainter::CompositionMode_SourceOver;
+
+    QImage* target = direct ? static_cast<QImage*>(device) : 0;
+    if (target && target->format() != QImage::Format_ARGB32_Premultiplied &&
+        target->format() != QImage::Format_RGB32)
+        target = 0;
+
+    if (!target) {
+        QImage colored = mask.copy(source);
+#if QT_VERSION >= 0x050500
+        if (colored.format() == QImage::Format_Alpha8)
+            colored = colored.convertToFormat(QImage::Format_Indexed8, shadowColorTable(Qt::black));
+#endif
+        colored.setColorTable(shadowColorTable(color));
+        painter->drawImage(position + source.topLeft(), colored);
+        return;
+    }
+
+    QVector<QRgb> colorTable = premultipliedColorTable(color);
+    QPoint offset = position + QPoint(qRound(transform.dx()), qRound(transform.dy()));
+    QRect area = QRect(offset + source.topLeft(), source.size()) & target->rect();
+    for (int y = area.top(); y <= area.bottom(); ++y) {
+        const uchar* p = mask.constScanLine(y - offset.y()) + area.left() - offset.x();
+        QRgb* q = reinterpret_cast<QRgb*>(target->scanLine(y)) + area.left();
+        for (int x = 0; x < area.width(); ++x) {
+            if (!p[x])
+                continue;
+            QRgb s = colorTable[p[x]];
+            q[x] = s + byteMul(q[x], 255 - qAlpha(s));
+        }
+    }
 }
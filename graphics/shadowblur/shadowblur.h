@@ -32,6 +32,89 @@
 
 #include <QImage>
 
-void shadowBlur(QImage& image, int radius, const QColor& color);
+class QPainter;
+
+// Which kernel runs the box blur passes. AutoDetect picks the best one
+// supported by the CPU at run-time, the others force a specific path
+// (mostly useful to compare against the scalar reference).
+enum ShadowBlurInstructionSet {
+    ShadowBlurAutoDetect,
+    ShadowBlurScalar,
+    ShadowBlurSSE2,
+    ShadowBlurAVX2,
+    ShadowBlurNEON
+};
+
+struct ShadowBlurOptions
+{
+    ShadowBlurOptions();
+
+    ShadowBlurInstructionSet instructionSet;
+
+    // Number of columns the vertical pass transposes and blurs in one
+    // sweep. Rounded up to a multiple of 16, which is also the smallest
+    // (unblocked) setting.
+    int columnBlock;
+
+    // Both passes are split across QThreadPool::globalInstance() using at
+    // most threadCount threads, the calling one included. 0 means
+    // QThread::idealThreadCount(), 1 keeps everything on the calling
+    // thread. Images with fewer than threadThreshold pixels are never
+    // split, the overhead would outweigh the gain.
+    int threadCount;
+    int threadThreshold;
+
+    // When non-zero, large radii blur a 2x or 4x downscaled copy of the
+    // alpha and scale the result back up bilinearly. The largest factor
+    // which keeps the reduced radius at or above downsampleRadius is used,
+    // thus a higher value means better quality and less speed-up. 16 is
+    // a good compromise, 0 (the default) always blurs at full resolution.
+    int downsampleRadius;
+
+    // For Format_ARGB32_Premultiplied images, the last blur pass writes the
+    // shadow color directly instead of a separate QPainter colorize pass
+    // over the image. Other formats always go through QPainter.
+    bool fusedColorize;
+};
+
+// Blurs the alpha of image and fills it with color. Only the bounding box
+// of the non-transparent pixels, grown by shadowBlurExtent(), is touched.
+// That area is returned, everything outside of it is fully transparent
+// and does not need to be composited.
+QRect shadowBlur(QImage& image, int radius, const QColor& color);
+QRect shadowBlur(QImage& image, int radius, const QColor& color, const ShadowBlurOptions& options);
+
+// Same as shadowBlur(), but the source is left untouched and the shadow
+// is returned as a Format_Indexed8 image, a quarter of the size, whose
+// color table maps every alpha value to the shadow color.
+QImage shadowMask(const QImage& image, int radius, const QColor& color,
+                  const ShadowBlurOptions& options = ShadowBlurOptions(), QRect* dirtyRect = 0);
+
+// Same as shadowBlur(), but with a recursive Gaussian of standard deviation
+// sigma (at most ShadowBlurMaxSigma) instead of the three box passes. The
+// cost per pixel does not depend on sigma and fractional values are fine,
+// thus the blur can be animated smoothly. shadowBlurSigma() converts a
+// shadowBlur() radius to the sigma of the Gaussian it approximates.
+static const qreal ShadowBlurMaxSigma = 64;
+QRect shadowBlurGaussian(QImage& image, qreal sigma, const QColor& color,
+                         const ShadowBlurOptions& options = ShadowBlurOptions());
+qreal shadowBlurSigma(int radius);
+int shadowBlurGaussianExtent(qreal sigma);
+
+// The alpha-only pipeline: alphaMask() extracts the alpha of an image
+// into an 8-bit plane (Format_Indexed8, or Format_Alpha8 with Qt >= 5.5
+// which is passed through as is), shadowBlurAlpha() blurs such a plane in
+// place and returns its dirty area, and drawShadow() composites it with
+// the shadow color at draw time. shadowBlur() also accepts 8-bit planes.
+QImage alphaMask(const QImage& image);
+QRect shadowBlurAlpha(QImage& mask, int radius, const ShadowBlurOptions& options = ShadowBlurOptions());
+void drawShadow(QPainter* painter, const QPoint& position, const QImage& mask,
+                const QColor& color, const QRect& sourceRect = QRect());
+
+// How far, in pixels, the shadow spreads beyond the opaque pixels.
+int shadowBlurExtent(int radius);
+
+bool shadowBlurSupports(ShadowBlurInstructionSet instructionSet);
+ShadowBlurInstructionSet shadowBlurInstructionSet(const ShadowBlurOptions& options = ShadowBlurOptions());
 
 #endif
@@ -0,0 +1,110 @@
+/*
+  This file is part of the Ofi Labs X2 project.
+
+  Copyright (C) 2010 Ariya Hidayat <ariya.hidayat@gmail.com>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+  THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "shadowblur_p.h"
+
+#ifdef SHADOWBLUR_HAVE_AVX2
+
+#include <immintrin.h>
+
+// Same as the SSE2 kernel, but with sixteen lanes. The functions are
+// compiled for AVX2 on their own so that the rest of the code does not
+// need any special compiler flag, shadowBlur() only calls into them
+// after checking the CPU at run-time.
+#define AVX2_FUNCTION __attribute__((target("avx2")))
+
+AVX2_FUNCTION
+static inline __m256i load16(const uchar *p)
+{
+    return _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+}
+
+AVX2_FUNCTION
+static inline void store16(uchar *p, __m256i sum, __m256i invCount)
+{
+    __m256i lo = _mm256_mullo_epi16(sum, invCount);
+    __m256i hi = _mm256_mulhi_epu16(sum, invCount);
+    __m256i v = _mm256_or_si256(_mm256_slli_epi16(hi, 16 - BlurSumShift), _mm256_srli_epi16(lo, BlurSumShift));
+    __m128i packed = _mm_packus_epi16(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(p), packed);
+}
+
+AVX2_FUNCTION
+static void boxBlurStep(const uchar *src, uchar *dst, int stride, int dim,
+                        int side1, int side2, int invCount)
+{
+    int ofs = 1 + side2;
+    __m256i alpha1 = load16(src);
+    __m256i alpha2 = load16(src + (dim - 1) * stride);
+    __m256i inv = _mm256_set1_epi16(short(invCount));
+    uchar* ptr = dst;
+    const uchar* prev = src + stride;
+    const uchar* next = src + ofs * stride;
+
+    int i;
+    __m256i sum = _mm256_mullo_epi16(alpha1, _mm256_set1_epi16(side1 + 1));
+    int limit = (dim < side2 + 1) ? dim : side2 + 1;
+    for (i = 1; i < limit; ++i, prev += stride)
+        sum = _mm256_add_epi16(sum, load16(prev));
+    if (limit <= side2)
+        sum = _mm256_add_epi16(sum, _mm256_mullo_epi16(alpha2, _mm256_set1_epi16(side2 - limit + 1)));
+
+    limit = (side1 < dim) ? side1 : dim;
+    for (i = 0; i < limit; ptr += stride, next += stride, ++i, ++ofs) {
+        store16(ptr, sum, inv);
+        sum = _mm256_add_epi16(sum, _mm256_sub_epi16((ofs < dim) ? load16(next) : alpha2, alpha1));
+    }
+    prev = src;
+    for (; ofs < dim; ptr += stride, prev += stride, next += stride, ++i, ++ofs) {
+        store16(ptr, sum, inv);
+        sum = _mm256_add_epi16(sum, _mm256_sub_epi16(load16(next), load16(prev)));
+    }
+    for (; i < dim; ptr += stride, prev += stride, ++i) {
+        store16(ptr, sum, inv);
+        sum = _mm256_add_epi16(sum, _mm256_sub_epi16(alpha2, load16(prev)));
+    }
+}
+
+AVX2_FUNCTION
+void boxBlurLanes_avx2(uchar *src, uchar *dst, int stride, int lanes, int dim, const BoxBlurKernel &kernel)
+{
+    int l = 0;
+    for (; l + 16 <= lanes; l += 16) {
+        boxBlurStep(src + l, dst + l, stride, dim,
+                    kernel.side1[0], kernel.side2[0], kernel.invCount[0]);
+        boxBlurStep(dst + l, src + l, stride, dim,
+                    kernel.side1[1], kernel.side2[1], kernel.invCount[1]);
+        boxBlurStep(src + l, dst + l, stride, dim,
+                    kernel.side1[2], kernel.side2[2], kernel.invCount[2]);
+    }
+    if (l < lanes)
+        boxBlurLanes(src + l, dst + l, stride, lanes - l, dim, kernel);
+}
+
+#endif // SHADOWBLUR_HAVE_AVX2
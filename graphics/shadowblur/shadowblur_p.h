@@ -0,0 +1,170 @@
+/*
+  This file is part of the Ofi Labs X2 project.
+
+  Copyright (C) 2010 Ariya Hidayat <ariya.hidayat@gmail.com>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+  THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef OFILABS_SHADOWBLUR_P
+#define OFILABS_SHADOWBLUR_P
+
+// Internal kernels shared by the different shadowBlur() code paths.
+// Not part of the public API.
+
+#include "shadowblur.h"
+
+#include <QColor>
+#include <QImage>
+#include <QRect>
+#include <QVector>
+#include <QtGlobal>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SHADOWBLUR_HAVE_SSE2
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || (defined(__GNUC__) && (__GNUC__ * 100 + __GNUC_MINOR__ >= 409)))
+#define SHADOWBLUR_HAVE_AVX2
+#endif
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#define SHADOWBLUR_HAVE_NEON
+#endif
+
+static const int BlurSumShift = 15;
+
+// Number of lines gathered and blurred together. Must be a multiple
+// of the widest SIMD lane count (16 for AVX2).
+static const int BlurLaneGroup = 16;
+
+// Default number of columns gathered at once by the vertical pass.
+// 256 columns of ARGB32 pixels are sixteen cache lines per row, the
+// fewer sweeps over the rows the fewer cache and TLB misses.
+static const int BlurColumnBlock = 256;
+
+// The three box passes. Each pass averages side1 pixels before and
+// side2 pixels after the current one, the division is replaced by
+// a multiplication with invCount and a shift by BlurSumShift.
+struct BoxBlurKernel
+{
+    int side1[3];
+    int side2[3];
+    int invCount[3];
+};
+
+BoxBlurKernel boxBlurKernel(int radius);
+
+// Blurs lanes stored interleaved, i.e. element i of lane l is at
+// src[i * stride + l]. The result is written to dst, src is used as
+// scratch space and does not hold anything useful afterwards.
+typedef void (*BoxBlurLanesFunction)(uchar *src, uchar *dst, int stride, int lanes,
+                                     int dim, const BoxBlurKernel &kernel);
+
+void boxBlurLanes(uchar *src, uchar *dst, int stride, int lanes, int dim, const BoxBlurKernel &kernel);
+#ifdef SHADOWBLUR_HAVE_SSE2
+void boxBlurLanes_sse2(uchar *src, uchar *dst, int stride, int lanes, int dim, const BoxBlurKernel &kernel);
+#endif
+#ifdef SHADOWBLUR_HAVE_AVX2
+void boxBlurLanes_avx2(uchar *src, uchar *dst, int stride, int lanes, int dim, const BoxBlurKernel &kernel);
+#endif
+#ifdef SHADOWBLUR_HAVE_NEON
+void boxBlurLanes_neon(uchar *src, uchar *dst, int stride, int lanes, int dim, const BoxBlurKernel &kernel);
+#endif
+
+// The recursive Gaussian: every output is b times the input plus the
+// previous three outputs weighted by a, once forwards and once backwards.
+struct GaussianKernel
+{
+    float b;
+    float a[3];
+};
+
+GaussianKernel gaussianKernel(qreal sigma);
+
+// Same layout as BoxBlurLanesFunction, at most BlurLaneGroup lanes. src is
+// left untouched, scratch holds stride * dim floats.
+void gaussianBlurLanes(const uchar *src, uchar *dst, float *scratch, int stride, int lanes, int dim,
+                       const GaussianKernel &kernel);
+
+// Offset of the alpha byte within a (little endian) ARGB32 pixel.
+static const int ArgbAlphaOffset = 3;
+
+// The alpha values of an image. bits points to the alpha of the top-left
+// pixel, pixelStride is 4 for 32-bit images and 1 for 8-bit planes.
+// If colorTable is set (32-bit images only), the last pass does not store
+// the blurred alpha but colorTable[alpha] as the whole pixel.
+struct AlphaPlane
+{
+    uchar *bits;
+    int pixelStride;
+    int bytesPerLine;
+    int width;
+    int height;
+    const QRgb *colorTable;
+};
+
+static inline void storeAlpha(uchar *p, uchar alpha, const QRgb *colorTable)
+{
+    if (colorTable)
+        *reinterpret_cast<QRgb*>(p - ArgbAlphaOffset) = colorTable[alpha];
+    else
+        *p = alpha;
+}
+
+void blurHorizontal(const AlphaPlane &plane, const BoxBlurKernel &kernel, BoxBlurLanesFunction blurLanes);
+void blurVertical(const AlphaPlane &plane, const BoxBlurKernel &kernel, BoxBlurLanesFunction blurLanes,
+                  int blockWidth);
+
+BoxBlurLanesFunction boxBlurLanesFunction(ShadowBlurInstructionSet instructionSet);
+
+// Maps every alpha value to the color, premultiplied, exactly like a
+// CompositionMode_SourceIn fill with it would.
+QVector<QRgb> premultipliedColorTable(const QColor &color);
+
+// Copies the alpha of image, any format, into an 8-bit buffer.
+void extractAlpha(const QImage &image, uchar *dst, int bytesPerLine);
+
+// Smallest rectangle holding every non-transparent pixel.
+QRect alphaBoundingRect(const AlphaPlane &plane);
+AlphaPlane alphaSubPlane(const AlphaPlane &plane, const QRect &rect);
+
+// Both passes, spread across the thread pool according to the options.
+void blurAlphaPlane(const AlphaPlane &plane, int radius, const ShadowBlurOptions &options);
+void blurAlphaPlaneGaussian(const AlphaPlane &plane, qreal sigma, const ShadowBlurOptions &options);
+
+class ParallelTask
+{
+public:
+    virtual ~ParallelTask() { }
+    virtual void run(int index) = 0;
+};
+
+// Calls task->run() for every index in [0, count) using up to threadCount
+// threads (the calling one included) and returns when all are done.
+// A threadCount of 0 means QThread::idealThreadCount().
+void runParallel(ParallelTask *task, int count, int threadCount);
+
+#endif
@@ -0,0 +1,103 @@
+/*
+  This file is part of the Ofi Labs X2 project.
+
+  Copyright (C) 2010 Ariya Hidayat <ariya.hidayat@gmail.com>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+  THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "shadowblur_p.h"
+
+#ifdef SHADOWBLUR_HAVE_SSE2
+
+#include <emmintrin.h>
+
+// Eight lanes are processed at once, each one held in a 16-bit slot.
+// The running sum never exceeds 129 * 255, thus it fits and the
+// sum * invCount product is assembled from its low and high halves.
+
+static inline __m128i load8(const uchar *p)
+{
+    return _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)), _mm_setzero_si128());
+}
+
+static inline void store8(uchar *p, __m128i sum, __m128i invCount)
+{
+    __m128i lo = _mm_mullo_epi16(sum, invCount);
+    __m128i hi = _mm_mulhi_epu16(sum, invCount);
+    __m128i v = _mm_or_si128(_mm_slli_epi16(hi, 16 - BlurSumShift), _mm_srli_epi16(lo, BlurSumShift));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(p), _mm_packus_epi16(v, v));
+}
+
+static void boxBlurStep(const uchar *src, uchar *dst, int stride, int dim,
+                        int side1, int side2, int invCount)
+{
+    int ofs = 1 + side2;
+    __m128i alpha1 = load8(src);
+    __m128i alpha2 = load8(src + (dim - 1) * stride);
+    __m128i inv = _mm_set1_epi16(short(invCount));
+    uchar* ptr = dst;
+    const uchar* prev = src + stride;
+    const uchar* next = src + ofs * stride;
+
+    int i;
+    __m128i sum = _mm_mullo_epi16(alpha1, _mm_set1_epi16(side1 + 1));
+    int limit = (dim < side2 + 1) ? dim : side2 + 1;
+    for (i = 1; i < limit; ++i, prev += stride)
+        sum = _mm_add_epi16(sum, load8(prev));
+    if (limit <= side2)
+        sum = _mm_add_epi16(sum, _mm_mullo_epi16(alpha2, _mm_set1_epi16(side2 - limit + 1)));
+
+    limit = (side1 < dim) ? side1 : dim;
+    for (i = 0; i < limit; ptr += stride, next += stride, ++i, ++ofs) {
+        store8(ptr, sum, inv);
+        sum = _mm_add_epi16(sum, _mm_sub_epi16((ofs < dim) ? load8(next) : alpha2, alpha1));
+    }
+    prev = src;
+    for (; ofs < dim; ptr += stride, prev += stride, next += stride, ++i, ++ofs) {
+        store8(ptr, sum, inv);
+        sum = _mm_add_epi16(sum, _mm_sub_epi16(load8(next), load8(prev)));
+    }
+    for (; i < dim; ptr += stride, prev += stride, ++i) {
+        store8(ptr, sum, inv);
+        sum = _mm_add_epi16(sum, _mm_sub_epi16(alpha2, load8(prev)));
+    }
+}
+
+void boxBlurLanes_sse2(uchar *src, uchar *dst, int stride, int lanes, int dim, const BoxBlurKernel &kernel)
+{
+    int l = 0;
+    for (; l + 8 <= lanes; l += 8) {
+        boxBlurStep(src + l, dst + l, stride, dim,
+                    kernel.side1[0], kernel.side2[0], kernel.invCount[0]);
+        boxBlurStep(dst + l, src + l, stride, dim,
+                    kernel.side1[1], kernel.side2[1], kernel.invCount[1]);
+        boxBlurStep(src + l, dst + l, stride, dim,
+                    kernel.side1[2], kernel.side2[2], kernel.invCount[2]);
+    }
+    if (l < lanes)
+        boxBlurLanes(src + l, dst + l, stride, lanes - l, dim, kernel);
+}
+
+#endif // SHADOWBLUR_HAVE_SSE2
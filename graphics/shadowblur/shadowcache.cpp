@@ -0,0 +1,164 @@
+/*
+  This file is part of the Ofi Labs X2 project.
+
+  Copyright (C) 2010 Ariya Hidayat <ariya.hidayat@gmail.com>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+  THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "shadowcache.h"
+#include "shadowblur_p.h"
+
+bool ShadowCacheKey::operator==(const ShadowCacheKey &other) const
+{
+    return alphaHash == other.alphaHash && width == other.width && height == other.height &&
+           radius == other.radius && downsampleRadius == other.downsampleRadius &&
+           color == other.color && format == other.format;
+}
+
+uint qHash(const ShadowCacheKey &key)
+{
+    return uint(key.alphaHash ^ (key.alphaHash >> 32)) ^ (key.radius << 24) ^ (uint(key.format) << 16) ^ key.color;
+}
+
+// 64-bit FNV-1a over the alpha values only. extractAlpha() reads them
+// from any format, 8-bit masks included.
+static quint64 alphaHash(const QImage &image)
+{
+    QVector<uchar> alpha(image.width() * image.height());
+    extractAlpha(image, alpha.data(), image.width());
+
+    quint64 hash = Q_UINT64_C(14695981039346656037);
+    for (int i = 0; i < alpha.count(); ++i) {
+        hash ^= alpha.at(i);
+        hash *= Q_UINT64_C(1099511628211);
+    }
+    return hash;
+}
+
+// Images whose alpha hash is remembered.
+const int ImageHashCount = 256;
+
+ShadowCache::ShadowCache(int maxBytes)
+    : m_cache(maxBytes)
+    , m_imageHashes(ImageHashCount)
+    , m_hits(0)
+    , m_misses(0)
+{
+}
+
+ShadowCacheKey ShadowCache::key(const QImage &image, int radius, const QColor &color,
+                                const ShadowBlurOptions &options)
+{
+    return key(alphaHash(image), image, radius, color, options);
+}
+
+ShadowCacheKey ShadowCache::key(quint64 alphaHash, const QImage &image, int radius, const QColor &color,
+                                const ShadowBlurOptions &options)
+{
+    ShadowCacheKey key;
+    key.alphaHash = alphaHash;
+    key.width = image.width();
+    key.height = image.height();
+    key.radius = qMin(radius, 128);
+    key.downsampleRadius = options.downsampleRadius;
+    key.color = color.rgba();
+    key.format = image.format();
+    return key;
+}
+
+quint64 ShadowCache::imageHash(const QImage &image)
+{
+    if (quint64* hash = m_imageHashes.object(image.cacheKey()))
+        return *hash;
+    quint64 hash = alphaHash(image);
+    m_imageHashes.insert(image.cacheKey(), new quint64(hash));
+    return hash;
+}
+
+QImage ShadowCache::shadow(const QImage &image, int radius, const QColor &color,
+                           const ShadowBlurOptions &options, QRect *dirtyRect)
+{
+    ShadowCacheKey cacheKey = key(imageHash(image), image, radius, color, options);
+    if (ShadowCacheEntry* cached = m_cache.object(cacheKey)) {
+        ++m_hits;
+        if (dirtyRect)
+            *dirtyRect = cached->dirtyRect;
+        return cached->image;
+    }
+
+    ++m_misses;
+    ShadowCacheEntry* entry = new ShadowCacheEntry;
+    entry->image = image;
+    entry->dirtyRect = shadowBlur(entry->image, radius, color, options);
+    if (dirtyRect)
+        *dirtyRect = entry->dirtyRect;
+    QImage result = entry->image;
+
+    // QCache refuses (and deletes) anything larger than the whole budget.
+    m_cache.insert(cacheKey, entry, result.byteCount());
+    return result;
+}
+
+int ShadowCache::maxBytes() const
+{
+    return m_cache.maxCost();
+}
+
+void ShadowCache::setMaxBytes(int maxBytes)
+{
+    m_cache.setMaxCost(maxBytes);
+}
+
+int ShadowCache::totalBytes() const
+{
+    return m_cache.totalCost();
+}
+
+int ShadowCache::count() const
+{
+    return m_cache.count();
+}
+
+void ShadowCache::clear()
+{
+    m_cache.clear();
+    m_imageHashes.clear();
+}
+
+int ShadowCache::hits() const
+{
+    return m_hits;
+}
+
+int ShadowCache::misses() const
+{
+    return m_misses;
+}
+
+void ShadowCache::resetStatistics()
+{
+    m_hits = 0;
+    m_misses = 0;
+}
@@ -0,0 +1,103 @@
+/*
+  This file is part of the Ofi Labs X2 project.
+
+  Copyright (C) 2010 Ariya Hidayat <ariya.hidayat@gmail.com>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+  THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef OFILABS_SHADOWCACHE
+#define OFILABS_SHADOWCACHE
+
+#include "shadowblur.h"
+
+#include <QCache>
+#include <QColor>
+#include <QImage>
+
+struct ShadowCacheKey
+{
+    quint64 alphaHash;
+    int width;
+    int height;
+    int radius;
+    int downsampleRadius;
+    QRgb color;
+    // The shadow keeps the format of the source.
+    QImage::Format format;
+
+    bool operator==(const ShadowCacheKey &other) const;
+};
+
+uint qHash(const ShadowCacheKey &key);
+
+struct ShadowCacheEntry
+{
+    QImage image;
+    QRect dirtyRect;
+};
+
+// Keeps the result of shadowBlur() around, so that drawing the same shadow
+// again costs a lookup instead of a blur. Entries are keyed on the alpha
+// content of the source (the colors do not matter for the shadow), the
+// radius, the shadow color and the format of the source. Once the images
+// exceed the byte budget, the least recently used ones are thrown out.
+//
+// Hashing the alpha takes a pass over the source, thus the hash is also
+// remembered per QImage::cacheKey(), which changes whenever the image
+// does: drawing the same image again only hashes it once.
+class ShadowCache
+{
+public:
+    ShadowCache(int maxBytes = 16 * 1024 * 1024);
+
+    // dirtyRect, when given, receives the area returned by shadowBlur().
+    QImage shadow(const QImage &image, int radius, const QColor &color,
+                  const ShadowBlurOptions &options = ShadowBlurOptions(), QRect *dirtyRect = 0);
+
+    int maxBytes() const;
+    void setMaxBytes(int maxBytes);
+    int totalBytes() const;
+    int count() const;
+    void clear();
+
+    int hits() const;
+    int misses() const;
+    void resetStatistics();
+
+    static ShadowCacheKey key(const QImage &image, int radius, const QColor &color,
+                              const ShadowBlurOptions &options = ShadowBlurOptions());
+
+private:
+    static ShadowCacheKey key(quint64 alphaHash, const QImage &image, int radius, const QColor &color,
+                              const ShadowBlurOptions &options);
+    quint64 imageHash(const QImage &image);
+
+    QCache<ShadowCacheKey, ShadowCacheEntry> m_cache;
+    QCache<qint64, quint64> m_imageHashes;
+    int m_hits;
+    int m_misses;
+};
+
+#endif
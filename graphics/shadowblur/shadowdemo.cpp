@@ -22,6 +22,7 @@
 
 #include "ui_parameters.h"
 #include "shadowblur.h"
+#include "shadowcache.h"
 
 class ShadowDemo: public QWidget
 {
@@ -45,6 +46,7 @@ private:
     QNetworkAccessManager m_networkManager;
     QImage m_image;
     QImage m_shadow;
+    ShadowCache m_shadowCache;
     QString m_fileName;
 };
 
@@ -169,9 +171,11 @@ void ShadowDemo::paintEvent(QPaintEvent*)
         color.setGreen(parameters.greenSlider->value());
         color.setBlue(parameters.blueSlider->value());
 
-        m_shadow = m_image;
-        shadowBlur(m_shadow, radius, color);
-        painter.drawImage(offsetX, offsetY, m_shadow);
+        // Repaints without any parameter change hit the cache. Only the
+        // area which holds the shadow needs to be composited.
+        QRect shadowRect;
+        m_shadow = m_shadowCache.shadow(m_image, radius, color, ShadowBlurOptions(), &shadowRect);
+        painter.drawImage(shadowRect.topLeft() + QPoint(offsetX, offsetY), m_shadow, shadowRect);
 
         if (!parameters.hideImageCheckBox->isChecked())
             painter.drawImage(0, 0, m_image);
@@ -1,4 +1,5 @@
-SOURCES = shadowdemo.cpp shadowblur.cpp
-HEADERS = shadowblur.h
+SOURCES = shadowdemo.cpp shadowblur.cpp shadowcache.cpp rectshadow.cpp shadowbatch.cpp shadowstream.cpp
+SOURCES += shadowblur_sse2.cpp shadowblur_avx2.cpp shadowblur_neon.cpp
+HEADERS = shadowblur.h shadowblur_p.h shadowcache.h rectshadow.h shadowbatch.h shadowstream.h
 FORMS += parameters.ui
 QT += network
@@ -0,0 +1,116 @@
+/*
+  This file is part of the Ofi Labs X2 project.
+
+  Copyright (C) 2010 Ariya Hidayat <ariya.hidayat@gmail.com>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+  THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "shadowstream.h"
+#include "shadowblur_p.h"
+
+#include <QVector>
+
+#include <string.h>
+
+// The vertical passes clamp at the edges of the window, unlike at the edges
+// of the image. That error creeps inwards by the reach of every pass, thus
+// after the three passes the rows at least shadowBlurExtent() away from the
+// window edges are exact. The horizontal passes always see whole rows.
+//
+// The unblurred alpha of the window is kept, so that the halo shared by
+// consecutive windows is read from the source only once.
+void shadowBlurStream(ShadowBlurSource *source, ShadowBlurSink *sink, int radius, const QColor &color,
+                      int bandHeight, const ShadowBlurOptions &options)
+{
+    if (!source || !sink)
+        return;
+
+    QSize size = source->size();
+    if (size.isEmpty())
+        return;
+
+    radius = qBound(0, radius, 128);
+    bandHeight = qMax(bandHeight, 1);
+    int width = size.width();
+    int height = size.height();
+    int extent = shadowBlurExtent(radius);
+    int windowHeight = qMin(bandHeight + 2 * extent, height);
+
+    QVector<uchar> alpha(width * windowHeight);
+    QVector<uchar> buffer(width * windowHeight);
+    QVector<QRgb> colorTable = premultipliedColorTable(color);
+    const QRgb* table = colorTable.constData();
+
+    // Rows [top, top + rows) of the image are in alpha.
+    int top = 0;
+    int rows = 0;
+
+    for (int y = 0; y < height; y += bandHeight) {
+        int count = qMin(bandHeight, height - y);
+        int windowTop = qMax(0, y - extent);
+        int windowBottom = qMin(height, y + count + extent);
+
+        int kept = top + rows - windowTop;
+        if (kept > 0 && windowTop > top)
+            memmove(alpha.data(), alpha.data() + (windowTop - top) * width, kept * width);
+        top = windowTop;
+        rows = qMax(kept, 0);
+
+        if (top + rows < windowBottom) {
+            QImage image = source->readRows(top + rows, windowBottom - top - rows);
+            extractAlpha(image, alpha.data() + rows * width, width);
+            rows = windowBottom - top;
+        }
+
+        QImage band(width, count, QImage::Format_ARGB32_Premultiplied);
+        if (band.isNull())
+            return;
+
+        AlphaPlane plane;
+        plane.bits = buffer.data();
+        plane.pixelStride = 1;
+        plane.bytesPerLine = width;
+        plane.width = width;
+        plane.height = rows;
+        plane.colorTable = 0;
+
+        // The blur works in place, the unblurred alpha is still needed for
+        // the next window.
+        memcpy(buffer.data(), alpha.constData(), rows * width);
+        if (alphaBoundingRect(plane).isEmpty()) {
+            band.fill(0);
+        } else {
+            blurAlphaPlane(plane, radius, options);
+            for (int i = 0; i < count; ++i) {
+                const uchar* p = buffer.constData() + (y - top + i) * width;
+                QRgb* q = reinterpret_cast<QRgb*>(band.scanLine(i));
+                for (int x = 0; x < width; ++x)
+                    q[x] = table[p[x]];
+            }
+        }
+
+        sink->writeRows(y, band);
+    }
+}
@@ -0,0 +1,73 @@
+/*
+  This file is part of the Ofi Labs X2 project.
+
+  Copyright (C) 2010 Ariya Hidayat <ariya.hidayat@gmail.com>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+  THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef OFILABS_SHADOWSTREAM
+#define OFILABS_SHADOWSTREAM
+
+#include "shadowblur.h"
+
+#include <QColor>
+#include <QImage>
+#include <QSize>
+
+// Supplies the source of shadowBlurStream(), a few rows at a time. Rows
+// are requested from top to bottom, each of them exactly once, thus the
+// source can be a decoder or a renderer working in bands.
+class ShadowBlurSource
+{
+public:
+    virtual ~ShadowBlurSource() { }
+    virtual QSize size() const = 0;
+
+    // Returns rows [y, y + count) as an image of the full width, in any
+    // format that shadowBlur() accepts. Only the alpha is used.
+    virtual QImage readRows(int y, int count) = 0;
+};
+
+// Receives the result of shadowBlurStream(), from top to bottom.
+class ShadowBlurSink
+{
+public:
+    virtual ~ShadowBlurSink() { }
+
+    // rows holds rows [y, y + rows.height()) of the shadow, in
+    // Format_ARGB32_Premultiplied. It is only valid during the call.
+    virtual void writeRows(int y, const QImage &rows) = 0;
+};
+
+// Same result as shadowBlur() on the whole image with the color fused into
+// the last pass, but working on horizontal bands of bandHeight rows. Each
+// band is blurred together with shadowBlurExtent() rows of halo above and
+// below, which makes the result exact, and the memory needed proportional
+// to the band height times the width instead of the whole image. The
+// downsampleRadius option is ignored.
+void shadowBlurStream(ShadowBlurSource *source, ShadowBlurSink *sink, int radius, const QColor &color,
+                      int bandHeight = 256, const ShadowBlurOptions &options = ShadowBlurOptions());
+
+#endif
@@ -0,0 +1,291 @@
+/*
+    This file is part of the OfiLabs X2 project.
+
+    Copyright (C) 2010 Helder Correia <helder.pereira.correia@gmail.com>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of
+    the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "plasmakernel.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QImage>
+#include <QStringList>
+#include <QThread>
+#include <QVector>
+#include <QtAlgorithms>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct Settings
+{
+    Settings() : frames(60), warmup(5), threadCount(0), checkOnly(false) { }
+
+    int frames;
+    int warmup;
+    int threadCount;
+    bool checkOnly;
+};
+
+// The default pattern and palette of the effect.
+static QVector<uchar> createPattern(int width, int height)
+{
+    int maxDimension = qMax(width, height);
+    QVector<int> f(maxDimension);
+    for (int x = 0; x < maxDimension; ++x)
+        f[x] = qRound(20 * sin(x * 0.15) + 100 * cos(x * 0.015));
+
+    QVector<uchar> pattern(width * height);
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x)
+            pattern[y * width + x] = abs(f[x] + f[y]) % 255;
+    return pattern;
+}
+
+static QVector<QRgb> createPalette()
+{
+    QVector<QRgb> palette(256);
+    for (int i = 0; i < 128; ++i)
+        palette[i] = palette[255 - i] = qRgb(2 * i, 255 - 2 * i, 2 * i);
+    return palette;
+}
+
+static void rotatePalette(QVector<QRgb> &palette)
+{
+    for (int i = 0; i < 255; ++i)
+        palette[i] = palette[i + 1];
+    palette[255] = palette[0];
+}
+
+// Any 256 consecutive pixels hold every byte value, in scrambled order
+// (167 is odd, thus a generator modulo 256). With a palette without
+// duplicates, any wrong lookup shows up.
+static QVector<uchar> createCheckPattern(int width, int height)
+{
+    QVector<uchar> pattern(width * height);
+    uint offset = width * 31 + height;
+    for (int i = 0; i < pattern.count(); ++i)
+        pattern[i] = (i * 167 + offset) & 255;
+    return pattern;
+}
+
+static QVector<QRgb> createCheckPalette()
+{
+    QVector<QRgb> palette(256);
+    for (int i = 0; i < 256; ++i)
+        palette[i] = qRgb(i, 255 - i, (i * 37) & 255);
+    return palette;
+}
+
+// Prints the first pixel where the result differs from the reference.
+static bool compareImages(const QImage &reference, const QImage &result, const char *name)
+{
+    for (int y = 0; y < reference.height(); ++y) {
+        const QRgb *expected = reinterpret_cast<const QRgb *>(reference.constScanLine(y));
+        const QRgb *actual = reinterpret_cast<const QRgb *>(result.constScanLine(y));
+        for (int x = 0; x < reference.width(); ++x) {
+            if (expected[x] != actual[x]) {
+                printf("%dx%d: %s differs from scalar at %d,%d (%08x instead of %08x)\n",
+                       reference.width(), reference.height(), name, x, y, actual[x], expected[x]);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// The AVX2 kernel and the threaded lookup against the scalar one, for a
+// frame of the given size. Returns the number of mismatches.
+static int checkLookup(int width, int height, int threads)
+{
+    QVector<uchar> pattern = createCheckPattern(width, height);
+    QVector<QRgb> palette = createCheckPalette();
+
+    PlasmaLookupOptions options;
+    options.instructionSet = PlasmaScalar;
+    options.threadCount = 1;
+    QImage reference(width, height, QImage::Format_RGB32);
+    plasmaLookup(pattern.constData(), reference, palette.constData(), options);
+
+    int mismatches = 0;
+    if (plasmaSupports(PlasmaAVX2)) {
+        options.instructionSet = PlasmaAVX2;
+        QImage result(width, height, QImage::Format_RGB32);
+        plasmaLookup(pattern.constData(), result, palette.constData(), options);
+        mismatches += !compareImages(reference, result, "avx2");
+    }
+
+    options.instructionSet = PlasmaAutoDetect;
+    options.threadCount = threads;
+    options.threadThreshold = 0;
+    QImage result(width, height, QImage::Format_RGB32);
+    plasmaLookup(pattern.constData(), result, palette.constData(), options);
+    mismatches += !compareImages(reference, result, "threaded");
+    return mismatches;
+}
+
+// A frame as the RGB32 mode paints it: rotation, then the lookup pass.
+struct LookupFrame
+{
+    const uchar *pattern;
+    QImage *image;
+    QVector<QRgb> *palette;
+    PlasmaLookupOptions options;
+
+    void operator()() const
+    {
+        rotatePalette(*palette);
+        plasmaLookup(pattern, *image, palette->constData(), options);
+    }
+};
+
+// A frame of the indexed mode, including the conversion the raster paint
+// engine does when drawing it.
+struct IndexedFrame
+{
+    QImage *image;
+    QVector<QRgb> *palette;
+
+    void operator()() const
+    {
+        rotatePalette(*palette);
+        image->setColorTable(*palette);
+        QImage converted = image->convertToFormat(QImage::Format_RGB32);
+        Q_UNUSED(converted);
+    }
+};
+
+// Frames per second, from the median frame time.
+template <typename Frame>
+static double measure(const Frame &frame, const Settings &settings)
+{
+    QVector<qint64> times;
+    QElapsedTimer timer;
+    for (int i = 0; i < settings.warmup + settings.frames; ++i) {
+        timer.start();
+        frame();
+        qint64 elapsed = timer.nsecsElapsed();
+        if (i >= settings.warmup)
+            times.append(elapsed);
+    }
+    qSort(times.begin(), times.end());
+    qint64 median = times.at(times.count() / 2);
+    return median > 0 ? 1e9 / median : 0;
+}
+
+static void printUsage()
+{
+    printf("Usage: plasmabench [--frames n] [--threads n] [--check]\n\n");
+    printf("Frames per second of the plasma animation, with the RGB32 lookup\n");
+    printf("pass (scalar, AVX2, multi-threaded) and with the indexed image.\n");
+    printf("The AVX2 and threaded lookups are first checked against the scalar\n");
+    printf("one, the exit code is non-zero on any mismatch. --check stops there.\n");
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    Settings settings;
+
+    QStringList args = app.arguments();
+    for (int i = 1; i < args.count(); ++i) {
+        QString arg = args.at(i);
+        if (arg == "--frames" && i + 1 < args.count()) {
+            settings.frames = qMax(1, args.at(++i).toInt());
+        } else if (arg == "--threads" && i + 1 < args.count()) {
+            settings.threadCount = args.at(++i).toInt();
+        } else if (arg == "--check") {
+            settings.checkOnly = true;
+        } else {
+            printUsage();
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+
+    static const int sizes[][2] = { { 1280, 720 }, { 1920, 1080 }, { 3840, 2160 } };
+    bool avx2 = plasmaSupports(PlasmaAVX2);
+    int threads = settings.threadCount > 0 ? settings.threadCount : QThread::idealThreadCount();
+
+    // Widths around the 16 pixels of an AVX2 iteration, and the benchmark
+    // sizes themselves.
+    static const int checkWidths[] = { 1, 7, 15, 16, 17, 31, 33, 100, 1279 };
+    static const int checkHeights[] = { 1, 3, 17 };
+    int mismatches = 0;
+    int checks = 0;
+    for (unsigned w = 0; w < sizeof(checkWidths) / sizeof(checkWidths[0]); ++w) {
+        for (unsigned h = 0; h < sizeof(checkHeights) / sizeof(checkHeights[0]); ++h) {
+            mismatches += checkLookup(checkWidths[w], checkHeights[h], threads);
+            ++checks;
+        }
+    }
+    for (unsigned s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        mismatches += checkLookup(sizes[s][0], sizes[s][1], threads);
+        ++checks;
+    }
+    printf("Lookup checked against scalar for %d sizes: %d mismatch(es)%s\n\n", checks, mismatches,
+           avx2 ? "" : ", no AVX2");
+    if (settings.checkOnly)
+        return mismatches > 0 ? 1 : 0;
+
+    printf("Plasma frames per second, median of %d frames\n\n", settings.frames);
+    printf("%10s %10s %10s %10s %10s\n", "size", "scalar", "avx2",
+           qPrintable(QString("%1 threads").arg(threads)), "indexed");
+
+    for (unsigned s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        int width = sizes[s][0];
+        int height = sizes[s][1];
+        QVector<uchar> pattern = createPattern(width, height);
+        QVector<QRgb> palette = createPalette();
+        QImage image(width, height, QImage::Format_RGB32);
+
+        LookupFrame frame;
+        frame.pattern = pattern.constData();
+        frame.image = &image;
+        frame.palette = &palette;
+        frame.options.threadCount = 1;
+
+        frame.options.instructionSet = PlasmaScalar;
+        double scalar = measure(frame, settings);
+
+        double vectorized = 0;
+        if (avx2) {
+            frame.options.instructionSet = PlasmaAVX2;
+            vectorized = measure(frame, settings);
+        }
+
+        frame.options.instructionSet = PlasmaAutoDetect;
+        frame.options.threadCount = threads;
+        frame.options.threadThreshold = 0;
+        double threaded = measure(frame, settings);
+
+        QImage indexedImage(width, height, QImage::Format_Indexed8);
+        for (int y = 0; y < height; ++y)
+            memcpy(indexedImage.scanLine(y), pattern.constData() + y * width, width);
+        IndexedFrame indexedFrame;
+        indexedFrame.image = &indexedImage;
+        indexedFrame.palette = &palette;
+        double indexed = measure(indexedFrame, settings);
+
+        QByteArray size = QString("%1x%2").arg(width).arg(height).toLatin1();
+        QByteArray avx2Column = avx2 ? QByteArray::number(vectorized, 'f', 1) : QByteArray("-");
+        printf("%10s %10.1f %10s %10.1f %10.1f\n", size.constData(), scalar,
+               avx2Column.constData(), threaded, indexed);
+    }
+
+    return mismatches > 0 ? 1 : 0;
+}
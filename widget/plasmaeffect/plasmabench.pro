@@ -0,0 +1,5 @@
+TARGET = plasmabench
+CONFIG += console
+CONFIG -= app_bundle
+SOURCES = plasmabench.cpp plasmakernel.cpp plasmakernel_avx2.cpp
+HEADERS = plasmakernel.h
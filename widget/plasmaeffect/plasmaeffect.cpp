@@ -20,6 +20,8 @@
 #include <QtGui>
 #include <cmath>
 
+#include "plasmakernel.h"
+
 class PlasmaEffect : public QWidget
 {
     Q_OBJECT
@@ -39,6 +41,7 @@ public slots:
     void setInterval(int msec);
     void toggleAnimation();
     void toggleFullScreen();
+    void toggleIndexedColor();
 
 protected:
     virtual void keyPressEvent(QKeyEvent *event);
@@ -51,9 +54,10 @@ private:
     int m_plasmaWidth;
     int m_plasmaHeight;
     bool m_fullScreen;
+    bool m_indexedColor;
 
     QImage m_image;
-    int *m_pattern;
+    QVector<uchar> m_pattern;
     QVector<QRgb> m_palette;
     int m_timerInterval;
     QBasicTimer m_animationTimer;
@@ -72,13 +76,14 @@ private:
     int m_greenComponentChangeFactor;
     int m_blueComponentChangeFactor;
 
+    void createImage();
     void paintNextFrame();
     void setUp();
 };
 
 PlasmaEffect::PlasmaEffect(int width, int height, QWidget *parent) : QWidget(parent),
-    m_plasmaWidth(width), m_plasmaHeight(height), m_fullScreen(false),
-    m_pattern(0), m_palette(256),
+    m_plasmaWidth(width), m_plasmaHeight(height), m_fullScreen(false), m_indexedColor(true),
+    m_palette(256),
     m_timerInterval(40), m_baseFunction(sin),
     m_alpha(20), m_alphaAdjust(0.15), m_beta(100), m_betaAdjust(0.015),
     m_redComponent(0), m_greenComponent(255), m_blueComponent(0),
@@ -169,6 +174,16 @@ void PlasmaEffect::toggleFullScreen()
     }
 }
 
+// Switches between the indexed image, animated through its color table,
+// and the RGB32 one, where every pixel is looked up again for every frame.
+void PlasmaEffect::toggleIndexedColor()
+{
+    m_indexedColor = !m_indexedColor;
+    createImage();
+    setUp();
+    paintNextFrame();
+}
+
 void PlasmaEffect::keyPressEvent(QKeyEvent *event)
 {
     switch (event->key()) {
@@ -211,6 +226,7 @@ void PlasmaEffect::keyPressEvent(QKeyEvent *event)
     case Qt::Key_T: setBaseFunction(tan); break;
 
     case Qt::Key_F: toggleFullScreen(); break;
+    case Qt::Key_I: toggleIndexedColor(); break;
     case Qt::Key_Space: toggleAnimation(); break;
 
     case Qt::Key_O: setInterval(interval() + 5); break;
@@ -247,11 +263,8 @@ void PlasmaEffect::resizeEvent(QResizeEvent *event)
 {
     m_plasmaWidth = event->size().width();
     m_plasmaHeight = event->size().height();
-    m_image = QImage(m_plasmaWidth, m_plasmaHeight, QImage::Format_RGB32);
-
-    if (m_pattern)
-        delete m_pattern;
-    m_pattern = new int[m_plasmaWidth*m_plasmaHeight];
+    createImage();
+    m_pattern.resize(m_plasmaWidth * m_plasmaHeight);
 
     setUp();
 
@@ -264,18 +277,26 @@ void PlasmaEffect::timerEvent(QTimerEvent *)
     paintNextFrame();
 }
 
+void PlasmaEffect::createImage()
+{
+    QImage::Format format = m_indexedColor ? QImage::Format_Indexed8 : QImage::Format_RGB32;
+    m_image = QImage(m_plasmaWidth, m_plasmaHeight, format);
+}
+
 void PlasmaEffect::paintNextFrame()
 {
     for (int i = 0; i < 255; ++i)
         m_palette[i] = m_palette[i + 1];
     m_palette[255] = m_palette[0];
 
-    QRgb *bits = reinterpret_cast<QRgb*>(m_image.bits());
-    int *p = m_pattern;
-    for (int y = 0; y < m_plasmaHeight; ++y)
-        for (int x = 0; x < m_plasmaWidth; ++x)
-            *bits++ = m_palette[*p++];
+    // The pixels hold the pattern itself, only the 256 colors change.
+    if (m_indexedColor) {
+        m_image.setColorTable(m_palette);
+        update();
+        return;
+    }
 
+    plasmaLookup(m_pattern.constData(), m_image, m_palette.constData());
     update();
 }
 
@@ -299,6 +320,13 @@ void PlasmaEffect::setUp()
         for (int x = 0; x < m_plasmaWidth; ++x)
             m_pattern[y * m_plasmaWidth + x] = abs(f[x] + f[y]) % (255);
 
+    // Indexed scanlines are padded to 32 bits.
+    if (m_indexedColor) {
+        for (int y = 0; y < m_plasmaHeight; ++y)
+            memcpy(m_image.scanLine(y), m_pattern.constData() + y * m_plasmaWidth, m_plasmaWidth);
+        m_image.setColorTable(m_palette);
+    }
+
     delete[] f;
 }
 
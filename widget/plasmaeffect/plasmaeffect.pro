@@ -1,3 +1,4 @@
 TARGET = plasmaeffect
 TEMPLATE = app
-SOURCES += plasmaeffect.cpp
+SOURCES += plasmaeffect.cpp plasmakernel.cpp plasmakernel_avx2.cpp
+HEADERS += plasmakernel.h
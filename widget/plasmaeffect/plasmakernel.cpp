@@ -0,0 +1,155 @@
+/*
+    This file is part of the OfiLabs X2 project.
+
+    Copyright (C) 2010 Helder Correia <helder.pereira.correia@gmail.com>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of
+    the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "plasmakernel.h"
+
+#include <QAtomicInt>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QSharedPointer>
+#include <QThread>
+#include <QThreadPool>
+
+// Rows handed out to a thread at once.
+static const int LookupBandHeight = 32;
+
+PlasmaLookupOptions::PlasmaLookupOptions()
+    : instructionSet(PlasmaAutoDetect)
+    , threadCount(0)
+    , threadThreshold(640 * 360)
+{
+}
+
+static PlasmaInstructionSet detectInstructionSet()
+{
+#ifdef PLASMA_HAVE_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return PlasmaAVX2;
+#endif
+    return PlasmaScalar;
+}
+
+bool plasmaSupports(PlasmaInstructionSet instructionSet)
+{
+    static const PlasmaInstructionSet best = detectInstructionSet();
+    return instructionSet != PlasmaAVX2 || best == PlasmaAVX2;
+}
+
+PlasmaInstructionSet plasmaInstructionSet(const PlasmaLookupOptions &options)
+{
+    static const PlasmaInstructionSet best = detectInstructionSet();
+    if (options.instructionSet == PlasmaAutoDetect || !plasmaSupports(options.instructionSet))
+        return best;
+    return options.instructionSet;
+}
+
+void plasmaLookupRow(const uchar *src, QRgb *dst, int count, const QRgb *palette)
+{
+    for (int i = 0; i < count; ++i)
+        dst[i] = palette[src[i]];
+}
+
+struct LookupPass
+{
+    const uchar *pattern;
+    uchar *bits;
+    int bytesPerLine;
+    int width;
+    int height;
+    const QRgb *palette;
+    PlasmaLookupRowFunction lookupRow;
+
+    void run(int band) const
+    {
+        int last = qMin(height, (band + 1) * LookupBandHeight);
+        for (int y = band * LookupBandHeight; y < last; ++y)
+            lookupRow(pattern + y * width, reinterpret_cast<QRgb*>(bits + y * bytesPerLine), width, palette);
+    }
+};
+
+// Bands are claimed through the atomic counter: a worker starting late,
+// or never when the pool is busy, does not hold up the calling thread.
+struct LookupState
+{
+    LookupState(const LookupPass &p, int n) : pass(p), count(n), next(0) { }
+
+    bool runNext()
+    {
+        int band = next.fetchAndAddOrdered(1);
+        if (band >= count)
+            return false;
+        pass.run(band);
+        done.release();
+        return true;
+    }
+
+    LookupPass pass;
+    int count;
+    QAtomicInt next;
+    QSemaphore done;
+};
+
+class LookupWorker: public QRunnable
+{
+public:
+    LookupWorker(const QSharedPointer<LookupState> &state) : m_state(state) { }
+    void run() { while (m_state->runNext()) { } }
+
+private:
+    QSharedPointer<LookupState> m_state;
+};
+
+void plasmaLookup(const uchar *pattern, QImage &image, const QRgb *palette,
+                  const PlasmaLookupOptions &options)
+{
+    if (image.format() != QImage::Format_RGB32 && image.format() != QImage::Format_ARGB32)
+        return;
+
+    LookupPass pass;
+    pass.pattern = pattern;
+    pass.bits = image.bits();
+    pass.bytesPerLine = image.bytesPerLine();
+    pass.width = image.width();
+    pass.height = image.height();
+    pass.palette = palette;
+    pass.lookupRow = plasmaLookupRow;
+#ifdef PLASMA_HAVE_AVX2
+    if (plasmaInstructionSet(options) == PlasmaAVX2)
+        pass.lookupRow = plasmaLookupRow_avx2;
+#endif
+
+    int bands = (pass.height + LookupBandHeight - 1) / LookupBandHeight;
+    int threadCount = options.threadCount > 0 ? options.threadCount : QThread::idealThreadCount();
+    if (pass.width * pass.height < options.threadThreshold)
+        threadCount = 1;
+    threadCount = qMin(threadCount, bands);
+
+    if (threadCount <= 1) {
+        for (int band = 0; band < bands; ++band)
+            pass.run(band);
+        return;
+    }
+
+    QSharedPointer<LookupState> state(new LookupState(pass, bands));
+    for (int i = 1; i < threadCount; ++i)
+        QThreadPool::globalInstance()->start(new LookupWorker(state));
+    while (state->runNext()) { }
+    state->done.acquire(bands);
+}
@@ -0,0 +1,66 @@
+/*
+    This file is part of the OfiLabs X2 project.
+
+    Copyright (C) 2010 Helder Correia <helder.pereira.correia@gmail.com>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of
+    the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef OFILABS_PLASMAKERNEL
+#define OFILABS_PLASMAKERNEL
+
+#include <QImage>
+#include <QtGlobal>
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || (defined(__GNUC__) && (__GNUC__ * 100 + __GNUC_MINOR__ >= 409)))
+#define PLASMA_HAVE_AVX2
+#endif
+
+enum PlasmaInstructionSet {
+    PlasmaAutoDetect,
+    PlasmaScalar,
+    PlasmaAVX2
+};
+
+struct PlasmaLookupOptions
+{
+    PlasmaLookupOptions();
+
+    PlasmaInstructionSet instructionSet;
+
+    // 0 means QThread::idealThreadCount().
+    int threadCount;
+
+    // Frames with fewer pixels are done on the calling thread only.
+    int threadThreshold;
+};
+
+// Fills an RGB32 image with palette[pattern[i]] for every pixel. The
+// pattern holds one byte per pixel, row after row without padding.
+void plasmaLookup(const uchar *pattern, QImage &image, const QRgb *palette,
+                  const PlasmaLookupOptions &options = PlasmaLookupOptions());
+
+bool plasmaSupports(PlasmaInstructionSet instructionSet);
+PlasmaInstructionSet plasmaInstructionSet(const PlasmaLookupOptions &options = PlasmaLookupOptions());
+
+// Kernels for a single row, not part of the API.
+typedef void (*PlasmaLookupRowFunction)(const uchar *src, QRgb *dst, int count, const QRgb *palette);
+
+void plasmaLookupRow(const uchar *src, QRgb *dst, int count, const QRgb *palette);
+#ifdef PLASMA_HAVE_AVX2
+void plasmaLookupRow_avx2(const uchar *src, QRgb *dst, int count, const QRgb *palette);
+#endif
+
+#endif
@@ -0,0 +1,48 @@
+/*
+    This file is part of the OfiLabs X2 project.
+
+    Copyright (C) 2010 Helder Correia <helder.pereira.correia@gmail.com>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of
+    the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "plasmakernel.h"
+
+#ifdef PLASMA_HAVE_AVX2
+
+#include <immintrin.h>
+
+// Compiled for AVX2 on its own, the rest of the code needs no special
+// compiler flag. plasmaLookup() only calls it after checking the CPU.
+#define AVX2_FUNCTION __attribute__((target("avx2")))
+
+// Sixteen indices are widened to 32 bits, eight at a time, and gathered
+// from the palette. The palette is 1 KB, it stays in the L1 cache.
+AVX2_FUNCTION
+void plasmaLookupRow_avx2(const uchar *src, QRgb *dst, int count, const QRgb *palette)
+{
+    const int *table = reinterpret_cast<const int*>(palette);
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i indices = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m256i lo = _mm256_cvtepu8_epi32(indices);
+        __m256i hi = _mm256_cvtepu8_epi32(_mm_srli_si128(indices, 8));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_i32gather_epi32(table, lo, 4));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i + 8), _mm256_i32gather_epi32(table, hi, 4));
+    }
+    for (; i < count; ++i)
+        dst[i] = palette[src[i]];
+}
+
+#endif